@@ -1,33 +1,70 @@
 #include "AHD.h"
 #include "AHDUtils.h"
+#include "AHDCpuVoxelizer.h"
+#include "AHDDedup.h"
+#include "AHDFragmentCache.h"
+#include "AHDMorton.h"
+#include "AHDTexture.h"
+#include "AHDVertex.h"
+#include "AHDThreadPool.h"
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#ifdef AHD_D3D11
 #include "AHDd3d11Helper.h"
 #include <d3dcompiler.h>
-#include <functional>
+
+#pragma comment (lib,"d3d11.lib")
+#pragma comment (lib,"d3dx11.lib")
+#endif
 
 #undef max
 #undef min
 
 using namespace AHD;
 
-#pragma comment (lib,"d3d11.lib")
-#pragma comment (lib,"d3dx11.lib")
-
-#define EXCEPT(x) {throw std::exception(x);}
+#define EXCEPT(x) {throw std::runtime_error(x);}
 
 #define CHECK_RESULT(x, y) { if (FAILED(x)) EXCEPT(y); }
 #define SAFE_RELEASE(x) {if(x) (x)->Release(); (x) = 0;}
 
-
+#ifdef AHD_D3D11
 typedef D3D11Helper Helper;
+#endif
 
-namespace AHD
+namespace
 {
+	const std::vector<TileStat> NO_TILE_STATS;
 
-}
+	//sorts by key, ties keep the lower index first
+	struct SortKey
+	{
+		unsigned long long key;
+		unsigned int index;
 
+		bool operator < (const SortKey& rhs)const{ return key != rhs.key ? key < rhs.key : index < rhs.index; }
+	};
 
+	inline void hashBytes(unsigned long long& hash, const void* data, size_t size)
+	{
+		//8 bytes at a time, multiply and fold
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i += 8)
+		{
+			unsigned long long word = 0;
+			memcpy(&word, bytes + i, std::min<size_t>(size - i, 8));
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 32;
+		}
+	}
+}
+
+#ifdef AHD_D3D11
 void Effect::init(ID3D11Device* device, const std::map<Semantic, VertexDesc>& desc)
 {
 	auto end = desc.end();
@@ -119,101 +156,456 @@ void Effect::clean()
 	mPixelShader->Release();
 	mGeometryShader->Release();
 }
+#endif
 
-void VoxelResource::setVertex(const void* vertices, size_t vertexCount, size_t vertexStride, const VertexDesc* desc, size_t size)
+const VertexDesc& VoxelResource::setDesc(const VertexDesc* desc, size_t size)
 {
-	const VertexDesc* pos = nullptr;
-	const VertexDesc* color = nullptr;
-	const VertexDesc* uv = nullptr;
+	mDesc.clear();
 	for (size_t i = 0; i < size; ++i)
 	{
-		switch (desc[i].semantic)
-		{
-		case S_POSITION: pos = desc + i; break;
-		case S_COLOR: color = desc + i; break;
-		case S_TEXCOORD: uv = desc + i; break;
-		default:
+		if (desc[i].semantic < 0 || desc[i].semantic >= S_NUM)
 			EXCEPT("unexpected semantic")
-			break;
-		}
-		mDesc[desc[i].semantic] = desc[i];
+		mDesc[desc[i].semantic] = VertexDecoder::resolve(desc[i]);
 	}
+	auto pos = mDesc.find(S_POSITION);
+	if (pos == mDesc.end())
+		EXCEPT("no position");
+	return pos->second;
+}
 
-
-	int newVertexStride = pos->size + (uv?uv->size:0) + (color?color->size:0);
+void VoxelResource::setVertex(const void* vertices, size_t vertexCount, size_t vertexStride, const VertexDesc* desc, size_t size)
+{
+	mDirty = true;
+	mBvh.clear();
+	const VertexDesc& pos = setDesc(desc, size);
+	mAABB = VertexBound::compute(pos, vertices, vertexCount, vertexStride);
+
+	//the offsets change to the repacked ones. the cpu backend keeps the formats, the input
+	//layout of a device only takes the default ones so it gets them decoded
+	size_t newVertexStride = 0;
+	std::vector<VertexDesc> from;
+	std::vector<VertexDesc> to;
+	for (auto& i : mDesc)
+	{
+		from.push_back(i.second);
+		if (mDevice)
+		{
+			VertexDesc expanded = { i.first, 0, VertexDecoder::getSize(i.first, VF_DEFAULT), VF_DEFAULT };
+			i.second = VertexDecoder::resolve(expanded);
+		}
+		i.second.offset = newVertexStride;
+		newVertexStride += i.second.size;
+		to.push_back(i.second);
+	}
 	mVertexStride = newVertexStride;
 	mVertexCount = vertexCount;
 
-	mAABB.setNull();
-	size_t buffersize = vertexCount * vertexStride;
-	std::vector<char> buffer;
-	buffer.reserve(buffersize);
+	std::vector<bool> raw;
+	for (size_t i = 0; i < from.size(); ++i)
 	{
+		bool scaled = false;
+		for (int c = 0; c < 3; ++c)
+			scaled = scaled || from[i].scale[c] != 1 || from[i].bias[c] != 0;
+		raw.push_back(from[i].format == to[i].format && !(mDevice && scaled));
+	}
 
+	std::vector<char> buffer(vertexCount * newVertexStride);
+	{
 		const char* begin = (const char*)vertices;
-		const char* end = begin + buffersize;
+		const char* end = begin + vertexCount * vertexStride;
 		char* wbegin = buffer.data();
 		for (; begin != end; begin += vertexStride)
 		{
-			Vector3 v = (*(const Vector3*)(begin + pos->offset));
-			mAABB.merge(v);
-			memcpy(wbegin, begin + pos->offset, pos->size);
-			wbegin += pos->size;
-			if (color)
-			{
-				memcpy(wbegin, begin + color->offset, color->size);
-				wbegin += color->size;
-			}
-			if (uv)
+			for (size_t i = 0; i < from.size(); ++i)
 			{
-				memcpy(wbegin, begin + uv->offset, uv->size);
-				wbegin += uv->size;
+				if (raw[i])
+					memcpy(wbegin, begin + from[i].offset, to[i].size);
+				else
+				{
+					float v[4];
+					VertexDecoder::decode(from[i], begin, v);
+					if (to[i].format == VF_UNORM8)
+					{
+						for (int c = 0; c < 4; ++c)
+							wbegin[c] = (char)(unsigned char)(std::min(std::max(v[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+					}
+					else
+						memcpy(wbegin, v, to[i].size);
+				}
+				wbegin += to[i].size;
 			}
-
 		}
 	}
 
-	CHECK_RESULT(Helper::createBuffer(&mVertexBuffer, mDevice, D3D11_BIND_VERTEX_BUFFER, buffersize, buffer.data()),
-		"fail to create vertex buffer,  cant use gpu voxelizer");
+#ifdef AHD_D3D11
+	if (mDevice)
+	{
+		CHECK_RESULT(Helper::createBuffer(&mVertexBuffer, mDevice, D3D11_BIND_VERTEX_BUFFER, buffer.size(), buffer.data()),
+			"fail to create vertex buffer,  cant use gpu voxelizer");
+		return;
+	}
+#endif
+	mVertexData.swap(buffer);
+	mVertices = mVertexData.data();
+}
+
+void VoxelResource::setVertexView(const void* vertices, size_t vertexCount, size_t vertexStride, const VertexDesc* desc, size_t size)
+{
+	if (mDevice)
+	{
+		setVertex(vertices, vertexCount, vertexStride, desc, size);
+		return;
+	}
+
+	mDirty = true;
+	mBvh.clear();
+	const VertexDesc& pos = setDesc(desc, size);
+	mAABB = VertexBound::compute(pos, vertices, vertexCount, vertexStride);
+	mVertexStride = vertexStride;
+	mVertexCount = vertexCount;
+	std::vector<char>().swap(mVertexData);
+	mVertices = (const char*)vertices;
 }
 
 
 void VoxelResource::setIndex(const void* indexes, size_t indexCount, size_t indexStride)
 {
 	size_t size = indexCount * indexStride;
+	mDirty = true;
+	mBvh.clear();
 	mIndexStride = indexStride;
 	mIndexCount = indexCount;
 
-	CHECK_RESULT(Helper::createBuffer(&mIndexBuffer, mDevice, D3D11_BIND_INDEX_BUFFER, size, indexes),
-		"fail to create index buffer,  cant use gpu voxelizer");
+#ifdef AHD_D3D11
+	if (mDevice)
+	{
+		CHECK_RESULT(Helper::createBuffer(&mIndexBuffer, mDevice, D3D11_BIND_INDEX_BUFFER, size, indexes),
+			"fail to create index buffer,  cant use gpu voxelizer");
+		return;
+	}
+#endif
+	if (indexStride != 2 && indexStride != 4)
+		EXCEPT("unknown index format");
+	mIndexData.assign((const char*)indexes, (const char*)indexes + size);
+	mCompactIndices.clear();
+}
+
+void VoxelResource::optimize(float weldDistance)
+{
+	if (mDevice || !mVertices || mVertexCount == 0)
+		return;
+
+	mDirty = true;
+	mBvh.clear();
+	ThreadPool& pool = *mPool;
+	const VertexDesc pos = mDesc[S_POSITION];
+	std::vector<VertexDesc> attributes;
+	for (auto& i : mDesc)
+	{
+		if (i.first != S_POSITION)
+			attributes.push_back(i.second);
+	}
+
+	//the weld key is the cell of weldDistance, or the exact bits, plus every other attribute
+	std::vector<Vector3> positions(mVertexCount);
+	auto getCell = [&](size_t v, long long* cell)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (weldDistance > 0)
+				cell[i] = (long long)floor((double)positions[v][i] / weldDistance);
+			else
+			{
+				unsigned int bits;
+				memcpy(&bits, &positions[v][i], 4);
+				cell[i] = bits;
+			}
+		}
+	};
+	auto isSame = [&](size_t a, size_t b)
+	{
+		long long ca[3], cb[3];
+		getCell(a, ca);
+		getCell(b, cb);
+		if (memcmp(ca, cb, sizeof(ca)) != 0)
+			return false;
+		for (auto& i : attributes)
+		{
+			if (memcmp(mVertices + a * mVertexStride + i.offset, mVertices + b * mVertexStride + i.offset, i.size) != 0)
+				return false;
+		}
+		return true;
+	};
+
+	std::vector<SortKey> vertexKeys(mVertexCount);
+	pool.parallelFor(mVertexCount, 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t v = begin; v < end; ++v)
+		{
+			const char* vertex = mVertices + v * mVertexStride;
+			VertexDecoder::decode(pos, vertex, &positions[v].x);
+			long long cell[3];
+			getCell(v, cell);
+			unsigned long long hash = 0xcbf29ce484222325ull;
+			hashBytes(hash, cell, sizeof(cell));
+			for (auto& i : attributes)
+				hashBytes(hash, vertex + i.offset, i.size);
+			vertexKeys[v].key = hash;
+			vertexKeys[v].index = (unsigned int)v;
+		}
+	});
+	pool.parallelSort(vertexKeys.data(), vertexKeys.data() + vertexKeys.size(), std::less<SortKey>());
+
+	//a run of equal hashes welds into its first vertex, the rare collision stays apart
+	std::vector<unsigned int> weld(mVertexCount);
+	pool.parallelFor(mVertexCount, 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		size_t first = begin;
+		while (first > 0 && vertexKeys[first - 1].key == vertexKeys[begin].key)
+			--first;
+		for (size_t n = begin; n < end; ++n)
+		{
+			if (vertexKeys[n].key != vertexKeys[first].key)
+				first = n;
+			unsigned int v = vertexKeys[n].index;
+			weld[v] = first != n && isSame(vertexKeys[first].index, v) ? vertexKeys[first].index : v;
+		}
+	});
+
+	//zero area triangles sort last, the rest by the morton code of the centroid in the bound
+	size_t indexCount = isIndexed() ? mIndexCount : mVertexCount;
+	const unsigned long long DEGENERATE = ~0ull;
+	const float CELLS = (float)((1 << Morton::AXIS_BITS) - 1);
+	Vector3 low = mAABB.getMin();
+	Vector3 size = mAABB.getSize();
+	std::vector<SortKey> triangleKeys(indexCount / 3);
+	pool.parallelFor(triangleKeys.size(), 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t n = begin; n < end; ++n)
+		{
+			unsigned int t[3];
+			for (int k = 0; k < 3; ++k)
+				t[k] = weld[getIndex(n * 3 + k)];
+			const Vector3& a = positions[t[0]];
+			const Vector3& b = positions[t[1]];
+			const Vector3& c = positions[t[2]];
+
+			triangleKeys[n].index = (unsigned int)n;
+			if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2] || (b - a).crossProduct(c - a) == Vector3::ZERO)
+			{
+				triangleKeys[n].key = DEGENERATE;
+				continue;
+			}
+
+			int cell[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				float centroid = (a[i] + b[i] + c[i]) / 3;
+				float f = size[i] > 0 ? (centroid - low[i]) / size[i] : 0;
+				cell[i] = (int)(std::min(std::max(f, 0.0f), 1.0f) * CELLS);
+			}
+			triangleKeys[n].key = Morton::encode(cell[0], cell[1], cell[2]);
+		}
+	});
+	pool.parallelSort(triangleKeys.data(), triangleKeys.data() + triangleKeys.size(), std::less<SortKey>());
+	SortKey last = { DEGENERATE, 0 };
+	size_t triangles = std::lower_bound(triangleKeys.begin(), triangleKeys.end(), last) - triangleKeys.begin();
+
+	//vertices in order of first use, the unused ones go
+	std::vector<unsigned int> remap(mVertexCount, UINT_MAX);
+	std::vector<unsigned int> used;
+	std::vector<unsigned int> indices(triangles * 3);
+	for (size_t n = 0; n < triangles; ++n)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = weld[getIndex(triangleKeys[n].index * 3 + k)];
+			if (remap[v] == UINT_MAX)
+			{
+				remap[v] = (unsigned int)used.size();
+				used.push_back(v);
+			}
+			indices[n * 3 + k] = remap[v];
+		}
+	}
+
+	std::vector<char> buffer(used.size() * mVertexStride);
+	pool.parallelFor(used.size(), 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t n = begin; n < end; ++n)
+			memcpy(buffer.data() + n * mVertexStride, mVertices + used[n] * mVertexStride, mVertexStride);
+	});
+	mVertexData.swap(buffer);
+	mVertices = mVertexData.data();
+	mVertexCount = used.size();
+	mAABB = VertexBound::compute(pos, mVertices, mVertexCount, mVertexStride);
+
+	mIndexCount = indices.size();
+	mIndexStride = mVertexCount <= 0x10000 ? 2 : 4;
+	mIndexData.resize(mIndexCount * mIndexStride);
+	for (size_t i = 0; i < mIndexCount; ++i)
+	{
+		if (mIndexStride == 2)
+			((unsigned short*)mIndexData.data())[i] = (unsigned short)indices[i];
+		else
+			((unsigned int*)mIndexData.data())[i] = indices[i];
+	}
+	mCompactIndices.clear();
+}
+
+void VoxelResource::compact()
+{
+	if (mDevice)
+		return;
+
+	mDirty = true;
+	mBvh.clear();
+	if (!mIndexData.empty())
+	{
+		mCompactIndices.build(mIndexData.data(), mIndexCount, mIndexStride);
+		std::vector<char>().swap(mIndexData);
+	}
+
+	if (!mVertices || mVertexCount == 0)
+		return;
+
+	//unorm16 over the bound goes through the same decode as any other position format
+	const VertexDesc pos = mDesc[S_POSITION];
+	VertexDesc quantized = { S_POSITION, 0, 6, VF_UNORM16 };
+	const Vector3& low = mAABB.getMin();
+	Vector3 size = mAABB.getSize();
+	for (int i = 0; i < 3; ++i)
+	{
+		quantized.scale[i] = size[i];
+		quantized.bias[i] = low[i];
+	}
+	quantized = VertexDecoder::resolve(quantized);
+
+	//the other attributes follow as they are
+	size_t newVertexStride = quantized.size;
+	std::vector<VertexDesc> from;
+	std::vector<size_t> to;
+	for (auto& i : mDesc)
+	{
+		if (i.first == S_POSITION)
+			continue;
+		from.push_back(i.second);
+		to.push_back(newVertexStride);
+		i.second.offset = newVertexStride;
+		newVertexStride += i.second.size;
+	}
+	mDesc[S_POSITION] = quantized;
+
+	std::vector<char> buffer(mVertexCount * newVertexStride);
+	for (size_t n = 0; n < mVertexCount; ++n)
+	{
+		const char* vertex = mVertices + n * mVertexStride;
+		char* out = buffer.data() + n * newVertexStride;
+		float p[3];
+		VertexDecoder::decode(pos, vertex, p);
+		unsigned short q[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			float t = size[i] > 0 ? (p[i] - low[i]) / size[i] : 0;
+			q[i] = (unsigned short)(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+		}
+		memcpy(out, q, sizeof(q));
+		for (size_t i = 0; i < from.size(); ++i)
+			memcpy(out + to[i], vertex + from[i].offset, from[i].size);
+	}
+
+	mVertexData.swap(buffer);
+	mVertices = mVertexData.data();
+	mVertexStride = newVertexStride;
+	mAABB = VertexBound::compute(quantized, mVertices, mVertexCount, mVertexStride);
+}
+
+const TriangleBvh& VoxelResource::getBvh()
+{
+	if (mDevice || !mVertices)
+		EXCEPT("no vertices for a bvh, cpu backend only");
+	if (!mBvh.isEmpty())
+		return mBvh;
+
+	size_t triangles = (isIndexed() ? mIndexCount : mVertexCount) / 3;
+	const VertexDesc& pos = mDesc[S_POSITION];
+	std::vector<Vector3> corners(triangles * 3);
+	mPool->parallelFor(corners.size(), 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t i = begin; i < end; ++i)
+			VertexDecoder::decode(pos, mVertices + getIndex(i) * mVertexStride, &corners[i].x);
+	});
+	mBvh.build(*mPool, corners.data(), triangles);
+	return mBvh;
 }
 
 void VoxelResource::setTexture(const std::string& name)
 {
 	mTexture = name;
+	mDirty = true;
 }
 
-VoxelResource::VoxelResource(ID3D11Device* device)
-	:mDevice(device)
+void VoxelResource::setInstances(const Matrix4* worlds, size_t count)
 {
-
+	mInstances.assign(worlds, worlds + count);
+	mDirty = true;
 }
 
-VoxelResource::~VoxelResource()
+VoxelResource::VoxelResource(ID3D11Device* device, ThreadPool* pool)
+	:mDevice(device), mPool(pool)
 {
 
 }
 
-void VoxelResource::prepare(ID3D11DeviceContext* context)
+VoxelResource::~VoxelResource()
 {
 
+}
 
+unsigned int VoxelResource::getIndex(size_t i)const
+{
+	if (mCompactIndices.getCount())
+		return (unsigned int)mCompactIndices.get(i);
+	if (mIndexData.empty())
+		return (unsigned int)i;
+	if (mIndexStride == 2)
+		return ((const unsigned short*)mIndexData.data())[i];
+	return ((const unsigned int*)mIndexData.data())[i];
+}
 
+void VoxelResource::prepare()
+{
+	if (mInstances.empty())
+	{
+		mBound = mAABB;
+		return;
+	}
 
+	mBound.setNull();
+	for (auto& i : mInstances)
+	{
+		AABB aabb = mAABB;
+		aabb.transformAffine(i);
+		mBound.merge(aabb);
+	}
 }
 
-Voxelizer::Voxelizer()
+Voxelizer::Voxelizer(Backend backend)
+	:mBackend(backend)
 {
+	for (int i = 0; i < 3; ++i)
+		mGridOffset[i] = mGridSize[i] = 0;
+	mPool = new ThreadPool();
+	mDedup = new Deduplicator();
+	if (mBackend == B_CPU)
+	{
+		mCpu = new CpuVoxelizer(*mPool);
+		return;
+	}
+
+#ifndef AHD_D3D11
+	EXCEPT("built without d3d11, cant use gpu voxelizer");
+#else
 	Helper::createDevice(&mDevice, &mContext);
 
 	//no need to cull
@@ -235,6 +627,7 @@ Voxelizer::Voxelizer()
 			"fail to create rasterizer state,  cant use gpu voxelizer");
 		mContext->RSSetState(rasterizerState);
 	}
+#endif
 }
 
 Voxelizer::~Voxelizer()
@@ -249,17 +642,120 @@ Voxelizer::~Voxelizer()
 		delete i;
 	}
 
+#ifdef AHD_D3D11
 	for (auto i : mEffects)
 	{
 		i.second->clean();
 		delete i.second;
 	}
+#endif
 
+	delete mCache;
+	delete mCpu;
+	delete mDedup;
+	delete mPool;
 }
 
 void Voxelizer::setSize(float voxelSize, float scale)
 {
-	mScale = scale / voxelSize;
+	setSize(Vector3(voxelSize, voxelSize, voxelSize), scale);
+}
+
+void Voxelizer::setSize(const Vector3& voxelSize, float scale)
+{
+	if (voxelSize.x <= 0 || voxelSize.y <= 0 || voxelSize.z <= 0)
+		EXCEPT("voxel size has to be positive");
+	mScale = Vector3(scale / voxelSize.x, scale / voxelSize.y, scale / voxelSize.z);
+}
+
+void Voxelizer::getGridSize(int* size)const
+{
+	for (int i = 0; i < 3; ++i)
+		size[i] = mGridSize[i];
+}
+
+void Voxelizer::getGridOffset(int* offset)const
+{
+	for (int i = 0; i < 3; ++i)
+		offset[i] = mGridOffset[i];
+}
+
+Vector3 Voxelizer::getVoxelSize()const
+{
+	return Vector3(1.0f / mScale.x, 1.0f / mScale.y, 1.0f / mScale.z);
+}
+
+void Voxelizer::setSlabSize(int size)
+{
+	if (size != 0 && mCpu == nullptr)
+		EXCEPT("only the cpu backend can stream slabs");
+	mSlabSize = std::max(size, 0);
+}
+
+void Voxelizer::setTileSize(int size)
+{
+	if (mCpu)
+		mCpu->setTileSize(size);
+}
+
+const std::vector<TileStat>& Voxelizer::getTileStats()const
+{
+	return mCpu ? mCpu->getTileStats() : NO_TILE_STATS;
+}
+
+void Voxelizer::setFillMode(FillMode mode)
+{
+	if (mode != FM_SURFACE && mCpu == nullptr)
+		EXCEPT("only the cpu backend can fill the inside");
+	mFillMode = mode;
+	if (mCpu)
+		mCpu->setFillMode(mode);
+}
+
+void Voxelizer::setIncremental(bool enable)
+{
+	if (enable && mCpu == nullptr)
+		EXCEPT("only the cpu backend can voxelize incrementally");
+	mIncremental = enable;
+	if (!enable)
+	{
+		delete mCache;
+		mCache = nullptr;
+	}
+	else if (mCache == nullptr)
+		mCache = new FragmentCache();
+}
+
+const DedupStat& Voxelizer::getDedupStat()const
+{
+	return mDedup->getStat();
+}
+
+void Voxelizer::setResolvePolicy(ResolvePolicy policy)
+{
+	mDedup->setPolicy(policy);
+}
+
+Voxelizer::ResolvePolicy Voxelizer::getResolvePolicy()const
+{
+	return mDedup->getPolicy();
+}
+
+void Voxelizer::setLodReduction(ResolvePolicy policy, int minChildren)
+{
+	if (minChildren < 1 || minChildren > 8)
+		EXCEPT("a cell has 1 to 8 children");
+	mLodPolicy = policy;
+	mLodMinChildren = minChildren;
+}
+
+void Voxelizer::setRasterMode(RasterMode mode)
+{
+	if (mode != RM_CENTER && mCpu == nullptr)
+		EXCEPT("only the cpu backend can voxelize conservatively");
+	mRasterMode = mode;
+	if (mCpu)
+		mCpu->setRasterMode(mode);
 }
 
 Vector3 Voxelizer::prepare( size_t count, VoxelResource** res)
@@ -270,30 +766,208 @@ Vector3 Voxelizer::prepare( size_t count, VoxelResource** res)
 	AABB aabb;
 	for (size_t i = 0; i < count; ++i)
 	{
-		res[i]->prepare(mContext);
-		aabb.merge(res[i]->mAABB);
+		res[i]->prepare();
+		aabb.merge(res[i]->mBound);
 	}
 
-	
+	mBound = aabb;
 	Vector3 osize = aabb.getSize();
 
-	//transfrom
-	Vector3 center = aabb.getCenter();
-	mTranslation = XMMatrixTranspose(XMMatrixTranslation(-center.x, -center.y, -center.z));
-	
-
 	return aabb.getSize();
 }
 
+void Voxelizer::fitGrid(const Vector3& range, int align)
+{
+	if (mGridFit == GF_WORLD)
+	{
+		//the cells the bound touches and one more around them, conservative modes
+		//take the neighbours of a triangle lying on a cell face
+		mOrigin = mWorldOrigin;
+		for (int i = 0; i < 3; ++i)
+		{
+			double low = floor((mBound.getMin()[i] - mWorldOrigin[i]) * mScale[i]) - 1;
+			double high = floor((mBound.getMax()[i] - mWorldOrigin[i]) * mScale[i]) + 2;
+			low = floor(low / align) * align;
+			high = ceil(high / align) * align;
+			if (low < INT_MIN || high > INT_MAX)
+				EXCEPT("bound is too far from the world origin");
+			mGridOffset[i] = (int)low;
+			mGridSize[i] = (int)(high - low);
+		}
+	}
+	else
+	{
+		//centered on the bound, the cube is the longest axis on all of them
+		float length = std::max(range.x, std::max(range.y, range.z));
+		Vector3 extent = mGridFit == GF_CUBE ? Vector3(length, length, length) : range;
+		mOrigin = mBound.getCenter() - extent * 0.5f;
+		for (int i = 0; i < 3; ++i)
+		{
+			mGridOffset[i] = 0;
+			mGridSize[i] = std::max(1, (int)ceil(extent[i] * mScale[i]));
+		}
+	}
+
+#ifdef AHD_D3D11
+	//the gpu renders a cube of the longest grid axis in voxel units centered on 0,
+	//every axis is shifted so its first voxel lands on the min corner of the cube
+	float half = std::max(mGridSize[0], std::max(mGridSize[1], mGridSize[2])) * 0.5f;
+	Vector3 offset(-mGridOffset[0] - half, -mGridOffset[1] - half, -mGridOffset[2] - half);
+	mTranslation = XMMatrixTranspose(XMMatrixMultiply(XMMatrixMultiply(
+		XMMatrixTranslation(-mOrigin.x, -mOrigin.y, -mOrigin.z),
+		XMMatrixScaling(mScale.x, mScale.y, mScale.z)),
+		XMMatrixTranslation(offset.x, offset.y, offset.z)));
+#endif
+}
+
+size_t Voxelizer::voxelize(size_t count, VoxelResource** res, int minPos, int maxSize, size_t levels)
+{
+	if (levels == 0 || levels > Morton::AXIS_BITS)
+		EXCEPT("unexpected lod count");
+	if (levels > 1 && (!mDeduplicate || mSlabSize != 0))
+		EXCEPT("lods need deduplicate and the whole grid");
+
+	//no resources, or only points and degenerate triangles, leave an empty grid and no slabs.
+	//a bound flat on one or two axes still gets a grid
+	Vector3 range = prepare(count, res);
+	if (range == Vector3::ZERO)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			mGridOffset[i] = 0;
+			mGridSize[i] = 0;
+		}
+		return 0;
+	}
+
+	fitGrid(range, 1 << (levels - 1));
+	for (int i = 0; i < 3; ++i)
+	{
+		if (mGridSize[i] > VoxelKey::MAX_POS)
+			EXCEPT("grid is too large");
+		if (mGridOffset[i] < minPos || (long long)mGridOffset[i] + mGridSize[i] > maxSize)
+			EXCEPT("grid is too large for the voxel layout");
+	}
+
+	mSlabOffset = 0;
+	if (mBackend == B_CPU)
+	{
+		if (mSlabSize != 0 && mFillMode == FM_SOLID_FLOOD)
+			EXCEPT("the exterior flood needs the whole grid, cant stream slabs");
+
+		CpuVoxelizer::Grid grid;
+		grid.origin = mOrigin;
+		grid.scale = mScale;
+		for (int i = 0; i < 3; ++i)
+		{
+			grid.offset[i] = mGridOffset[i];
+			grid.size[i] = mGridSize[i];
+		}
+		if (!mIncremental)
+		{
+			mCpu->load(grid, count, res, mSlabSize ? mSlabSize : grid.size[2]);
+			return mCpu->getSlabCount();
+		}
+
+		if (mFillMode != FM_SURFACE || mSlabSize != 0)
+			EXCEPT("incremental voxelize only takes the surface of the whole grid");
+		//one resource at a time, so every fragment set belongs to one of them
+		mCache->setGrid(grid, mRasterMode);
+		std::vector<FragmentSpan> spans;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!res[i]->mDirty && mCache->has(res[i]))
+				continue;
+			mCpu->load(grid, 1, res + i, grid.size[2]);
+			spans.clear();
+			if (mCpu->getSlabCount() != 0)
+			{
+				mCpu->voxelizeSlab(0);
+				mCpu->getSpans(spans);
+			}
+			mCache->store(res[i], spans);
+			res[i]->mDirty = false;
+		}
+		mCache->select(count, res);
+		return 1;
+	}
+
+#ifdef AHD_D3D11
+	voxelizeGpu(count, res);
+#endif
+	return 1;
+}
+
+size_t Voxelizer::voxelizeSlab(size_t slab)
+{
+	if (mBackend == B_CPU)
+	{
+		if (!mIncremental)
+		{
+			mCpu->voxelizeSlab(slab);
+			mSlabOffset = mCpu->getSlabOffset(slab);
+		}
+
+		std::vector<FragmentSpan> spans;
+		size_t count = getFragmentSpans(spans);
+		if (!mDeduplicate)
+			return count;
+		int offset[3] = { mGridOffset[0], mGridOffset[1], mGridOffset[2] + mSlabOffset };
+		mDedup->run(*mPool, spans, offset);
+	}
+
+	std::vector<FragmentSpan> spans;
+	return mDedup->getSpans(spans);
+}
+
+size_t Voxelizer::voxelizeLevel(size_t level)
+{
+	if (level == 0)
+		return voxelizeSlab(0);
+	return mDedup->reduceLevel(*mPool, mLodPolicy, mLodMinChildren);
+}
 
-void Voxelizer::voxelize(VoxelOutput* output, size_t count, VoxelResource** res)
+void Voxelizer::write(void* out, size_t stride, VoxelWriter writer)
 {
-	Vector3 range;
-	if ((range = prepare(count, res)) == Vector3::ZERO)
+	//the deduplicator has absolute cells already, raw fragments are in the grid and the slab
+	std::vector<FragmentSpan> spans;
+	int offset[3] = { 0, 0, 0 };
+	if (mBackend == B_CPU && !mDeduplicate)
 	{
-		EXCEPT(" cant use gpu voxelizer");
+		getFragmentSpans(spans);
+		for (int k = 0; k < 3; ++k)
+			offset[k] = mGridOffset[k];
+		offset[2] += mSlabOffset;
 	}
+	else
+		mDedup->getSpans(spans);
 
+	mPool->parallelFor(spans.size(), 1, [&](size_t begin, size_t end, size_t thread)
+	{
+		int pos[3];
+		for (size_t i = begin; i < end; ++i)
+		{
+			char* voxel = (char*)out + spans[i].offset * stride;
+			for (size_t n = 0; n < spans[i].size; ++n, voxel += stride)
+			{
+				const Fragment& fragment = spans[i].data[n];
+				fragment.key.getPos(pos);
+				for (int k = 0; k < 3; ++k)
+					pos[k] += offset[k];
+				writer(voxel, pos, fragment.color, fragment.material);
+			}
+		}
+	});
+}
+
+size_t Voxelizer::getFragmentSpans(std::vector<FragmentSpan>& spans)const
+{
+	return mIncremental ? mCache->getSpans(spans) : mCpu->getSpans(spans);
+}
+
+#ifdef AHD_D3D11
+void Voxelizer::voxelizeGpu(size_t count, VoxelResource** res)
+{
 	auto mapBuffer = [this](std::function<void(void*)> cb, UAVObj& obj)
 	{
 
@@ -317,7 +991,7 @@ void Voxelizer::voxelize(VoxelOutput* output, size_t count, VoxelResource** res)
 	};
 
 
-	auto render = [mapBuffer, count, range, &res, this](UAVObj& uav, std::function<void(void*)> cb, bool bcount)
+	auto render = [mapBuffer, count, &res, this](UAVObj& uav, std::function<void(void*)> cb, bool bcount)
 	{
 		mContext->OMSetRenderTargetsAndUnorderedAccessViews(
 			0, 0, NULL, bcount ? 0 : 1, 1, &uav.uav, NULL);
@@ -325,7 +999,7 @@ void Voxelizer::voxelize(VoxelOutput* output, size_t count, VoxelResource** res)
 		mContext->ClearUnorderedAccessViewUint(uav.uav, initcolor);
 		for (size_t i = 0; i < count; ++i)
 		{
-			voxelizeImpl(res[i], range, bcount);
+			voxelizeImpl(res[i], bcount);
 		}
 		mapBuffer(cb, uav);
 
@@ -340,11 +1014,14 @@ void Voxelizer::voxelize(VoxelOutput* output, size_t count, VoxelResource** res)
 	{
 		UAVObj target;
 		Helper::createUAVBuffer(&target.buffer, &target.uav, mDevice, sizeof(Voxel), numVoxels);
-		render(target, std::function<void(void*)>([&output, numVoxels](void*data){output->output((Voxel*)data, numVoxels); }), false);
+		render(target, std::function<void(void*)>([numVoxels, this](void*data)
+		{
+			mDedup->run(*mPool, (const Voxel*)data, numVoxels, mDeduplicate, mGridOffset);
+		}), false);
 	}
 	else
 	{
-		output->output(nullptr, 0);
+		mDedup->run(*mPool, nullptr, 0, mDeduplicate, mGridOffset);
 	}
 }
 
@@ -369,7 +1046,7 @@ Effect* Voxelizer::getEffect(VoxelResource* res)
 }
 
 
-void Voxelizer::voxelizeImpl(VoxelResource* res, const Vector3& range, bool countOnly)
+void Voxelizer::voxelizeImpl(VoxelResource* res, bool countOnly)
 {
 
 
@@ -417,14 +1094,16 @@ void Voxelizer::voxelizeImpl(VoxelResource* res, const Vector3& range, bool coun
 
 	
 
-	float length = std::max(range.x, std::max(range.y, range.z));
+	//in voxel units, see fitGrid
+	float length = (float)std::max(mGridSize[0], std::max(mGridSize[1], mGridSize[2]));
+	float half = length / 2;
 
 	EffectParameter parameters;
 	parameters.bcount = countOnly;
 	parameters.world = mTranslation;
-	parameters.width = length* mScale;
-	parameters.height = length * mScale;
-	parameters.depth = length * mScale;
+	parameters.width = length;
+	parameters.height = length;
+	parameters.depth = length;
 
 
 
@@ -448,51 +1127,83 @@ void Voxelizer::voxelizeImpl(VoxelResource* res, const Vector3& range, bool coun
 
 	}
 
-	float half = length / 2;
 	parameters.proj = XMMatrixTranspose(XMMatrixOrthographicOffCenterLH(
 		-half, half, -half, half, -half, half));
 
 	D3D11_VIEWPORT vp;
-	vp.Width = length* mScale;
-	vp.Height = length* mScale;
+	vp.Width = length;
+	vp.Height = length;
 	vp.MinDepth = 0.0f;
 	vp.MaxDepth = 1.0f;
 	vp.TopLeftX = 0;
 	vp.TopLeftY = 0;
 	mContext->RSSetViewports(1, &vp);
 
-	effect->update(mContext,parameters);
+	//one draw per instance, the instance goes before the grid transform
+	size_t instances = std::max<size_t>(res->mInstances.size(), 1);
+	for (size_t i = 0; i < instances; ++i)
+	{
+		if (!res->mInstances.empty())
+		{
+			XMMATRIX world = XMLoadFloat4x4((const XMFLOAT4X4*)res->mInstances[i].m);
+			parameters.world = XMMatrixTranspose(XMMatrixMultiply(world, XMMatrixTranspose(mTranslation)));
+		}
+		effect->update(mContext, parameters);
 
-	if (useIndex)
-		mContext->DrawIndexed(count, start, 0);
-	else
-		mContext->Draw(count, start);
+		if (useIndex)
+			mContext->DrawIndexed(count, start, 0);
+		else
+			mContext->Draw(count, start);
+	}
 
 }
+#endif
 
 
 VoxelResource* Voxelizer::createResource()
 {
-	VoxelResource* vr = new VoxelResource(mDevice);
+#ifdef AHD_D3D11
+	VoxelResource* vr = new VoxelResource(mBackend == B_GPU ? mDevice : nullptr, mPool);
+#else
+	VoxelResource* vr = new VoxelResource(nullptr, mPool);
+#endif
 	mResources.push_back(vr);
 	return vr;
 }
 
 void Voxelizer::addTexture(const std::string& name, size_t width, size_t height, void* data)
 {
-	if (hasTexture(name))
+	//the fragments cached for the resources sampling name have the old colors
+	for (auto& i : mResources)
+	{
+		if (i->mTexture == name)
+			i->mDirty = true;
+	}
+
+#ifdef AHD_D3D11
+	mTextures.erase(name);
+#endif
+	if (mBackend == B_CPU)
+	{
+		mCpu->addTexture(name, width, height, data);
 		return;
+	}
 
+#ifdef AHD_D3D11
 	auto& texture = mTextures[name];
 	texture.width = width;
 	texture.height = height;
 	{
+		//the same chain the cpu backend samples, the sampler picks the level per voxel
+		MipTexture mips;
+		mips.build(width, height, data);
+
 		D3D11_TEXTURE2D_DESC desc;
 		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
 		desc.Width = width;
 		desc.Height = height;
 		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		desc.MipLevels = 1;
+		desc.MipLevels = mips.getLevelCount();
 		desc.ArraySize = 1;
 		desc.CPUAccessFlags = 0;
 		desc.SampleDesc.Count = 1;
@@ -500,11 +1211,15 @@ void Voxelizer::addTexture(const std::string& name, size_t width, size_t height,
 		desc.MiscFlags = 0;
 		desc.Usage = D3D11_USAGE_DEFAULT;
 
-		D3D11_SUBRESOURCE_DATA initdata;
-		initdata.pSysMem = data;
-		initdata.SysMemPitch = 4 * width;
-		initdata.SysMemSlicePitch = 4 * width * height;
-		CHECK_RESULT(mDevice->CreateTexture2D(&desc, &initdata, &texture.texture), "fail to create texture2d");
+		std::vector<D3D11_SUBRESOURCE_DATA> initdata(mips.getLevelCount());
+		for (size_t i = 0; i < initdata.size(); ++i)
+		{
+			const MipTexture::Level& level = mips.getLevel(i);
+			initdata[i].pSysMem = level.texels.data();
+			initdata[i].SysMemPitch = 4 * level.width;
+			initdata[i].SysMemSlicePitch = 4 * level.width * level.height;
+		}
+		CHECK_RESULT(mDevice->CreateTexture2D(&desc, initdata.data(), &texture.texture), "fail to create texture2d");
 	}
 		{
 			D3D11_SHADER_RESOURCE_VIEW_DESC desc;
@@ -531,10 +1246,16 @@ void Voxelizer::addTexture(const std::string& name, size_t width, size_t height,
 			sampDesc.MaxAnisotropy = 16;
 			CHECK_RESULT(mDevice->CreateSamplerState(&sampDesc, &texture.sampler), "fail to creat sampler");
 		}
-
+#endif
 }
 
 bool Voxelizer::hasTexture(const std::string& name)
 {
+	if (mBackend == B_CPU)
+		return mCpu->hasTexture(name);
+#ifdef AHD_D3D11
 	return mTextures.find(name) != mTextures.end();
+#else
+	return false;
+#endif
 }
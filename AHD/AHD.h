@@ -1,17 +1,33 @@
 #ifndef _AHD_H_
 #define _AHD_H_
 
+#if defined(_WIN32) && !defined(AHD_NO_D3D11)
+#define AHD_D3D11
+#endif
+
+#ifdef AHD_D3D11
 #include <d3d11.h>
 #include <D3DX11.h>
+#include <xnamath.h>
+#else
+struct ID3D11Device;
+#endif
 #include <vector>
 #include <string>
-#include <xnamath.h>
 #include "AHDUtils.h"
+#include "AHDMorton.h"
+#include "AHDCompactIndices.h"
+#include "AHDBvh.h"
 #include <set>
 #include <map>
 
 namespace AHD
 {
+	class CpuVoxelizer;
+	class Deduplicator;
+	class FragmentCache;
+	struct FragmentSpan;
+	class ThreadPool;
 
 
 	template<class T>
@@ -38,6 +54,7 @@ namespace AHD
 	};
 
 
+#ifdef AHD_D3D11
 	struct EffectParameter
 	{
 		XMMATRIX world;
@@ -49,6 +66,7 @@ namespace AHD
 		float depth;
 		int bcount;
 	};
+#endif
 
 	enum Semantic
 	{
@@ -59,13 +77,32 @@ namespace AHD
 		S_NUM
 	};
 
+	//format of every component, positions have 3, colors 4 (bgra) and texcoords 2.
+	//the cpu backend keeps them as they are and decodes while voxelizing
+	enum VertexFormat
+	{
+		VF_DEFAULT,//float positions and texcoords, 8 bit colors
+		VF_FLOAT,
+		VF_HALF,
+		VF_SNORM16,
+		VF_UNORM16,
+		VF_UNORM8,
+
+		VF_NUM
+	};
+
 	struct VertexDesc
 	{
 		Semantic semantic;
 		size_t offset;
 		size_t size;
+		VertexFormat format;
+		//positions are decoded * scale + bias, a zero scale reads as 1
+		float scale[3];
+		float bias[3];
 	};
 
+#ifdef AHD_D3D11
 	class Effect
 	{
 	public:
@@ -85,26 +122,72 @@ namespace AHD
 		static const UINT SLOT = 1;
 		static const size_t ELEM_SIZE = 4;
 	};
+#endif
 
 
 	class VoxelResource
 	{
 		friend class Voxelizer;
+		friend class CpuVoxelizer;
 	public :
 		void setVertex(const void* vertices, size_t vertexCount, size_t vertexStride, const VertexDesc* desc, size_t size);
+		//cpu backend, borrows vertices as they are instead of repacking a copy. they must stay
+		//valid until the resource is destroyed or given other vertices, call it again after
+		//editing them so the bound and the incremental cache follow. a device still copies
+		void setVertexView(const void* vertices, size_t vertexCount, size_t vertexStride, const VertexDesc* desc, size_t size);
 		void setIndex(const void* indexes, size_t indexCount, size_t indexStride);
+		//cpu backend, welds vertices within the same cell of weldDistance (0 takes equal
+		//positions) that share every other attribute, drops zero area triangles and sorts the
+		//rest along a morton curve of their centroids, so neighbouring triangles hit
+		//neighbouring voxels. vertices are renumbered in order of first use and copied from a
+		//view. runs on the voxelizer threads, call it before compact
+		void optimize(float weldDistance = 0);
+		//cpu backend, for resources kept between voxelizes: positions are requantized to
+		//16 bits in the bound and indices stored as small offsets per meshlet, both decoded
+		//while voxelizing. vertices of setVertexView are copied. call it after setVertex and
+		//setIndex, nothing happens with a device
+		void compact();
+		//cpu backend, the triangles of the resource (not of its instances) in a bvh for region
+		//and inside queries, triangle i being the one of indices 3i .. 3i + 2. built on the
+		//voxelizer threads on first use and kept until the vertices or indices change
+		const TriangleBvh& getBvh();
 		void setTexture(const std::string& name);
+		//goes to MaterialVoxel, cpu backend only
+		void setMaterial(unsigned short material){ mMaterial = material; mDirty = true; }
+		unsigned short getMaterial()const{ return mMaterial; }
+		//changed since the last incremental voxelize, see Voxelizer::setIncremental
+		bool isDirty()const{ return mDirty; }
+		//voxelized once under every world matrix instead of once as it is, none is as it is.
+		//the cpu backend sets the triangles up once for all of them, and instances that only
+		//differ by a whole number of voxels in translation share one rasterization (surface only)
+		void setInstances(const Matrix4* worlds, size_t count);
+		size_t getInstanceCount()const{ return mInstances.size(); }
 
 		~VoxelResource();
 
 	private:
-		VoxelResource(ID3D11Device* device);
-		void prepare(ID3D11DeviceContext* context);
+		VoxelResource(ID3D11Device* device, ThreadPool* pool);
+		//mDesc from desc, returns the position
+		const VertexDesc& setDesc(const VertexDesc* desc, size_t size);
+		bool isIndexed()const{ return !mIndexData.empty() || mCompactIndices.getCount() != 0; }
+		//vertex of index i, i itself without indices
+		unsigned int getIndex(size_t i)const;
+		void prepare();
 
 	private:
-
+#ifdef AHD_D3D11
 		Interface<ID3D11Buffer> mVertexBuffer = nullptr;
 		Interface<ID3D11Buffer> mIndexBuffer = nullptr;
+#endif
+		//repacked as position, [color], [texcoord], only kept without a device (cpu backend)
+		std::vector<char> mVertexData;
+		std::vector<char> mIndexData;
+		//mVertexData or the caller's buffer of setVertexView, mDesc offsets are from it
+		const char* mVertices = nullptr;
+		//mIndexData after compact
+		CompactIndices mCompactIndices;
+		//built by getBvh
+		TriangleBvh mBvh;
 
 		size_t mVertexStride;
 		size_t mIndexStride;
@@ -112,71 +195,348 @@ namespace AHD
 		size_t mIndexCount;
 
 		std::string mTexture;
+		unsigned short mMaterial = 0;
+		bool mDirty = true;
 		ID3D11Device* mDevice;
+		ThreadPool* mPool;
 
 		AABB mAABB;
+		//mAABB under the instances, set by prepare
+		AABB mBound;
+		std::vector<Matrix4> mInstances;
 
 		std::map<Semantic, VertexDesc> mDesc;
 	};
 
+	//voxel layouts for Voxelizer::voxelize, each one has MIN_POS and MAX_SIZE, the coordinates
+	//it can address are [MIN_POS, MAX_SIZE), set() taking the bgra8 color packed with color[0] in the low byte
+	//and getKey() for sorting and hashing, it takes coordinates in [VoxelKey::MIN_POS, VoxelKey::MAX_POS)
 	struct Voxel
 	{
 		int pos[3];
 		int color[4];
+
+		static const int MIN_POS = VoxelKey::MIN_POS;
+		static const int MAX_SIZE = VoxelKey::MAX_POS;
+		void set(const int* p, unsigned int bgra, unsigned int material)
+		{
+			for (int i = 0; i < 3; ++i)
+				pos[i] = p[i];
+			for (int c = 0; c < 4; ++c)
+				color[c] = (bgra >> (c * 8)) & 0xff;
+		}
+		VoxelKey getKey()const{ return VoxelKey::make(pos); }
+	};
+
+	//64 bits, x and y in 11 bits, z in 10, so every axis is limited to MAX_SIZE (the one of z)
+	struct PackedVoxel
+	{
+		unsigned int pos;
+		unsigned int color;//bgra8
+
+		static const int MIN_POS = 0;
+		static const int MAX_SIZE = 1 << 10;
+		void set(const int* p, unsigned int bgra, unsigned int material)
+		{
+			pos = (unsigned int)p[0] | ((unsigned int)p[1] << 11) | ((unsigned int)p[2] << 22);
+			color = bgra;
+		}
+		int getX()const{ return pos & 0x7ff; }
+		int getY()const{ return (pos >> 11) & 0x7ff; }
+		int getZ()const{ return pos >> 22; }
+		VoxelKey getKey()const{ return VoxelKey::make(getX(), getY(), getZ()); }
 	};
 
-	class VoxelOutput
+	//32 bits, occupancy only, packed like PackedVoxel
+	struct PositionVoxel
+	{
+		unsigned int pos;
+
+		static const int MIN_POS = 0;
+		static const int MAX_SIZE = 1 << 10;
+		void set(const int* p, unsigned int bgra, unsigned int material)
+		{
+			pos = (unsigned int)p[0] | ((unsigned int)p[1] << 11) | ((unsigned int)p[2] << 22);
+		}
+		int getX()const{ return pos & 0x7ff; }
+		int getY()const{ return (pos >> 11) & 0x7ff; }
+		int getZ()const{ return pos >> 22; }
+		VoxelKey getKey()const{ return VoxelKey::make(getX(), getY(), getZ()); }
+	};
+
+	//64 bits, the material of the resource (VoxelResource::setMaterial) instead of a color,
+	//inside voxels of the solid modes get 0
+	struct MaterialVoxel
+	{
+		unsigned short pos[3];
+		unsigned short material;
+
+		static const int MIN_POS = 0;
+		static const int MAX_SIZE = 1 << 16;
+		void set(const int* p, unsigned int bgra, unsigned int m)
+		{
+			for (int i = 0; i < 3; ++i)
+				pos[i] = (unsigned short)p[i];
+			material = (unsigned short)m;
+		}
+		VoxelKey getKey()const{ return VoxelKey::make(pos[0], pos[1], pos[2]); }
+	};
+
+	//cpu backend, one for every task of the last voxelize, a crowded tile is cut into several
+	struct TileStat
+	{
+		int pos[3];//in tiles
+		size_t triangles;
+		size_t fragments;
+		size_t thread;
+		double time;//milliseconds
+	};
+
+	//fragments in, voxels out of the last deduplicated voxelize
+	struct DedupStat
+	{
+		size_t fragments;
+		size_t voxels;
+		float duplicateRatio;//fraction of the fragments that were merged away
+	};
+
+	template<class Layout>
+	class VoxelOutputT
 	{
 	public:
-		virtual void output(Voxel* voxels, size_t size) = 0;
+		virtual void output(Layout* voxels, size_t size) = 0;
 	};
 
+	typedef VoxelOutputT<Voxel> VoxelOutput;
+
 	class Voxelizer
 	{
-
+#ifdef AHD_D3D11
 		struct UAVObj
 		{
 			Interface<ID3D11Buffer> buffer;
 			Interface<ID3D11UnorderedAccessView> uav;
 			size_t size;
 		};
+#endif
+	public :
+		enum Backend
+		{
+			B_GPU,
+			B_CPU,
+
+#ifdef AHD_D3D11
+			B_DEFAULT = B_GPU,
+#else
+			B_DEFAULT = B_CPU,
+#endif
+		};
+
+		enum FillMode
+		{
+			FM_SURFACE,
+			//surface plus the voxels inside, mesh has to be watertight. cpu backend only
+			FM_SOLID_PARITY,
+			//surface plus whatever the outside can't reach, holes smaller than a voxel are fine
+			FM_SOLID_FLOOD,
+		};
+
+		enum RasterMode
+		{
+			//pixel centers of the dominant projection, same as the gpu
+			RM_CENTER,
+			//thin but tunnel free for 6-connected paths, cpu backend only
+			RM_6_SEPARATING,
+			//every voxel the triangle touches, cpu backend only
+			RM_26_SEPARATING,
+		};
+
+		//color of a voxel several fragments fall into, the same whatever order they come in
+		enum ResolvePolicy
+		{
+			RP_AVERAGE,
+			//weighted by the surface area each fragment stands for
+			RP_COVERAGE,
+			//the most opaque one, ties go to the larger color
+			RP_MAX_ALPHA,
+			//the most frequent color, ties go to the larger color
+			RP_MAJORITY,
+		};
+
+		//extent of the grid around the bound of the resources
+		enum GridFit
+		{
+			//the longest axis of the bound on every axis, the default
+			GF_CUBE,
+			//every axis just covers the bound, flat scenes get flat grids
+			GF_BOUND,
+			//cells of a fixed world grid (setWorldOrigin), coordinates are absolute and may be negative.
+			//separate voxelizes of neighbouring chunks line up and merge as they are
+			GF_WORLD,
+		};
+
 	public :
-		Voxelizer();
+		Voxelizer(Backend backend = B_DEFAULT);
 		~Voxelizer();
 
+		Backend getBackend()const{ return mBackend; }
+
 		void setSize(float voxelSize, float scale);
+		//voxel edge per axis, in world units before scale
+		void setSize(const Vector3& voxelSize, float scale);
+		void setGridFit(GridFit fit){ mGridFit = fit; }
+		GridFit getGridFit()const{ return mGridFit; }
+		//corner of cell (0, 0, 0) with GF_WORLD
+		void setWorldOrigin(const Vector3& origin){ mWorldOrigin = origin; }
+		const Vector3& getWorldOrigin()const{ return mWorldOrigin; }
+		//of the last voxelize, voxel (x, y, z) covers origin + (x, y, z) * getVoxelSize() and one voxel more
+		const Vector3& getGridOrigin()const{ return mOrigin; }
+		//the voxels are in [offset, offset + size), offset is only nonzero with GF_WORLD
+		void getGridSize(int* size)const;
+		void getGridOffset(int* offset)const;
+		Vector3 getVoxelSize()const;
+		//cpu backend, voxelizes the grid in z slabs of about this many voxels and hands every slab
+		//to the output on its own, so memory is bounded by the slab instead of the grid.
+		//0 is the whole grid at once, the default. FM_SOLID_FLOOD needs the whole grid
+		void setSlabSize(int size);
+		int getSlabSize()const{ return mSlabSize; }
+		//cpu backend, edge of the cubic tiles triangles are binned into, in voxels
+		void setTileSize(int size);
+		const std::vector<TileStat>& getTileStats()const;
+		void setFillMode(FillMode mode);
+		FillMode getFillMode()const{ return mFillMode; }
+		void setRasterMode(RasterMode mode);
+		RasterMode getRasterMode()const{ return mRasterMode; }
+		//one voxel per cell instead of one per fragment, on by default
+		void setDeduplicate(bool enable){ mDeduplicate = enable; }
+		bool getDeduplicate()const{ return mDeduplicate; }
+		void setResolvePolicy(ResolvePolicy policy);
+		ResolvePolicy getResolvePolicy()const;
+		const DedupStat& getDedupStat()const;
+		//cpu backend, keeps the fragments of every resource and only rasterizes the dirty ones
+		//(or ones it hasn't seen) again, the rest is merged from the cache. a change of the grid
+		//drops the cache, GF_WORLD keeps the grid still while the scene is edited. FM_SURFACE only, no slabs
+		void setIncremental(bool enable);
+		bool getIncremental()const{ return mIncremental; }
+
+		//output is called once per slab, in z order. a scene whose bound has no size has no
+		//slabs and output isn't called
+		template<class Layout>
+		void voxelize(VoxelOutputT<Layout>* output, size_t resourceNum, VoxelResource** res)
+		{
+			std::vector<Layout> voxels;
+			size_t slabs = voxelize(resourceNum, res, Layout::MIN_POS, Layout::MAX_SIZE);
+			for (size_t i = 0; i < slabs; ++i)
+			{
+				voxels.resize(voxelizeSlab(i));
+				write(voxels.data(), sizeof(Layout), &Voxelizer::writeVoxel<Layout>);
+				output->output(voxels.empty() ? nullptr : voxels.data(), voxels.size());
+			}
+		}
 
-		void voxelize(VoxelOutput* output, size_t resourceNum, VoxelResource** res);
+		//a mip chain from one voxelize, outputs[i] gets level i. level 0 is voxelize itself, every
+		//cell of level i + 1 is reduced from the up to 8 cells of level i it covers (setLodReduction),
+		//so cell (x, y, z) of level i covers voxels (x, y, z) * 2^i. with GF_WORLD the grid is aligned
+		//to the coarsest cell. needs deduplicate and the whole grid, no slabs
+		template<class Layout>
+		void voxelizeLods(VoxelOutputT<Layout>** outputs, size_t levels, size_t resourceNum, VoxelResource** res)
+		{
+			//every level of an empty scene is empty
+			std::vector<Layout> voxels;
+			bool empty = voxelize(resourceNum, res, Layout::MIN_POS, Layout::MAX_SIZE, levels) == 0;
+			for (size_t i = 0; i < levels; ++i)
+			{
+				if (!empty)
+				{
+					voxels.resize(voxelizeLevel(i));
+					write(voxels.data(), sizeof(Layout), &Voxelizer::writeVoxel<Layout>);
+				}
+				outputs[i]->output(voxels.empty() ? nullptr : voxels.data(), voxels.size());
+			}
+		}
+		//how voxelizeLods reduces 2x2x2 cells into one: the color of the children by policy and
+		//only cells with at least minChildren of them set are kept, 1 (the default) keeps every one
+		void setLodReduction(ResolvePolicy policy, int minChildren);
 
+#ifdef AHD_D3D11
 		void addEffect(Effect* effect);
 		void removeEffect(Effect* effect);
+#endif
 
 		VoxelResource* createResource();
+		//a name added again is replaced
 		void addTexture(const std::string& name, size_t width, size_t height, void* data);
 		bool hasTexture(const std::string& name);
 
 	private:
-		void voxelizeImpl(VoxelResource* res, const Vector3& range, bool countOnly);
+		typedef void(*VoxelWriter)(void* voxel, const int* pos, unsigned int color, unsigned int material);
+
+		template<class Layout>
+		static void writeVoxel(void* voxel, const int* pos, unsigned int color, unsigned int material)
+		{
+			((Layout*)voxel)->set(pos, color, material);
+		}
+
+		//fits the grid and loads the resources, returns the slab count. levels is for voxelizeLods
+		size_t voxelize(size_t resourceNum, VoxelResource** res, int minPos, int maxSize, size_t levels = 1);
+		//runs the backend and the dedup for one slab, returns the voxel count
+		size_t voxelizeSlab(size_t slab);
+		//level 0 is the whole grid, the others reduce the one before, returns the voxel count
+		size_t voxelizeLevel(size_t level);
+		//the voxels of the last slab into out, stride bytes apart
+		void write(void* out, size_t stride, VoxelWriter writer);
+		//fragments of the last slab before the dedup
+		size_t getFragmentSpans(std::vector<FragmentSpan>& spans)const;
+
 		Vector3 prepare( size_t resourceNum, VoxelResource** res);
+		//mOrigin, mGridOffset and mGridSize around mBound, GF_WORLD offsets are multiples of align
+		void fitGrid(const Vector3& range, int align);
+#ifdef AHD_D3D11
+		void voxelizeGpu(size_t count, VoxelResource** res);
+		void voxelizeImpl(VoxelResource* res, bool countOnly);
 		Effect* getEffect(VoxelResource* res);
 		void mapBuffer(void* data, size_t size, UAVObj& obj);
+#endif
 	private:
 
-
+		Backend mBackend;
 		VoxelResource* mCurrentResource;
-		float mScale = 1.0f;
+		Vector3 mScale = Vector3(1.0f, 1.0f, 1.0f);//voxels per world unit
 		Vector3 mSize;
-
+		AABB mBound;
+		GridFit mGridFit = GF_CUBE;
+		Vector3 mWorldOrigin = Vector3::ZERO;
+		Vector3 mOrigin = Vector3::ZERO;
+		int mGridOffset[3];
+		int mGridSize[3];
+		int mSlabSize = 0;
+		int mSlabOffset = 0;//z of the first voxel of the slab written last
+		ResolvePolicy mLodPolicy = RP_AVERAGE;
+		int mLodMinChildren = 1;
+		FillMode mFillMode = FM_SURFACE;
+		RasterMode mRasterMode = RM_CENTER;
+
+		bool mDeduplicate = true;
+		bool mIncremental = false;
+
+		ThreadPool* mPool = nullptr;
+		Deduplicator* mDedup = nullptr;
+		CpuVoxelizer* mCpu = nullptr;
+		FragmentCache* mCache = nullptr;
+
+#ifdef AHD_D3D11
 		XMMATRIX mTranslation;
 		XMMATRIX mProjection;
 		std::map<int, Effect*> mEffects;
 
 		Interface<ID3D11Device> mDevice;
 		Interface<ID3D11DeviceContext>	 mContext;
+#endif
 
 		std::vector<VoxelResource*> mResources;
 		std::vector<VoxelOutput*> mOutputs;
 
+#ifdef AHD_D3D11
 		struct Texture
 		{
 			Interface<ID3D11Texture2D> texture = nullptr;
@@ -187,6 +547,7 @@ namespace AHD
 		};
 
 		std::map<std::string, Texture> mTextures;
+#endif
 	};
 }
 
@@ -0,0 +1,45 @@
+#ifndef _AHDAppendBuffer_H_
+#define _AHDAppendBuffer_H_
+
+#include <vector>
+#include <memory>
+
+namespace AHD
+{
+	//grows by fixed chunks, nothing is moved or copied when it grows
+	//and clear keeps the chunks for the next round
+	template<class T>
+	class AppendBuffer
+	{
+	public:
+		static const size_t CHUNK_SIZE = 4096;
+
+	public:
+		void push_back(const T& value)
+		{
+			size_t chunk = mSize / CHUNK_SIZE;
+			if (chunk == mChunks.size())
+				mChunks.emplace_back(new T[CHUNK_SIZE]);
+			mChunks[chunk][mSize % CHUNK_SIZE] = value;
+			++mSize;
+		}
+
+		void clear(){ mSize = 0; }
+		size_t size()const{ return mSize; }
+		bool empty()const{ return mSize == 0; }
+
+		size_t getChunkCount()const{ return (mSize + CHUNK_SIZE - 1) / CHUNK_SIZE; }
+		const T* getChunk(size_t index)const{ return mChunks[index].get(); }
+		size_t getChunkSize(size_t index)const
+		{
+			size_t rest = mSize - index * CHUNK_SIZE;
+			return rest < CHUNK_SIZE ? rest : CHUNK_SIZE;
+		}
+
+	private:
+		std::vector<std::unique_ptr<T[]>> mChunks;
+		size_t mSize = 0;
+	};
+}
+
+#endif
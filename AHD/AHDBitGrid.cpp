@@ -0,0 +1,53 @@
+#include "AHDBitGrid.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace AHD;
+
+void BitGrid::resize(int width, int height, int depth)
+{
+	mSize[0] = width;
+	mSize[1] = height;
+	mSize[2] = depth;
+	mRowWords = ((size_t)width + WORD_BITS - 1) / WORD_BITS;
+
+	size_t count = getWordCount();
+	if (count > mCapacity)
+	{
+		mWords.reset(new std::atomic<Word>[count]);
+		mCapacity = count;
+	}
+	clear();
+}
+
+void BitGrid::clear()
+{
+	size_t count = getWordCount();
+	for (size_t i = 0; i < count; ++i)
+		store(i, 0);
+}
+
+BitGrid::Word BitGrid::getTailMask()const
+{
+	int bits = mSize[0] % WORD_BITS;
+	return bits ? ((Word)1 << bits) - 1 : ~(Word)0;
+}
+
+int BitGrid::countTrailingZeros(Word word)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)word))
+		return (int)index;
+	_BitScanForward(&index, (unsigned long)(word >> 32));
+	return (int)index + 32;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef _AHDBitGrid_H_
+#define _AHDBitGrid_H_
+
+#include <atomic>
+#include <memory>
+
+namespace AHD
+{
+	//one bit per voxel, rows along x are packed into 64 bit words.
+	//single bits are changed atomically, whole words with relaxed loads and stores
+	//by whoever owns the row.
+	class BitGrid
+	{
+	public:
+		typedef unsigned long long Word;
+		static const int WORD_BITS = 64;
+
+	public:
+		void resize(int width, int height, int depth);
+		void clear();
+
+		int getSize(int axis)const{ return mSize[axis]; }
+		size_t getRowWords()const{ return mRowWords; }
+		size_t getRowCount()const{ return (size_t)mSize[1] * mSize[2]; }
+		size_t getWordCount()const{ return getRowCount() * mRowWords; }
+		//first word of row (y, z)
+		size_t getRow(int y, int z)const{ return ((size_t)z * mSize[1] + y) * mRowWords; }
+		//valid bits of the last word in a row
+		Word getTailMask()const;
+
+		bool get(int x, int y, int z)const
+		{
+			return (load(getRow(y, z) + x / WORD_BITS) >> (x % WORD_BITS)) & 1;
+		}
+
+		void set(int x, int y, int z)
+		{
+			mWords[getRow(y, z) + x / WORD_BITS].fetch_or((Word)1 << (x % WORD_BITS), std::memory_order_relaxed);
+		}
+
+		void reset(int x, int y, int z)
+		{
+			mWords[getRow(y, z) + x / WORD_BITS].fetch_and(~((Word)1 << (x % WORD_BITS)), std::memory_order_relaxed);
+		}
+
+		void flip(int x, int y, int z)
+		{
+			mWords[getRow(y, z) + x / WORD_BITS].fetch_xor((Word)1 << (x % WORD_BITS), std::memory_order_relaxed);
+		}
+
+		Word load(size_t word)const{ return mWords[word].load(std::memory_order_relaxed); }
+		void store(size_t word, Word value){ mWords[word].store(value, std::memory_order_relaxed); }
+		//the word before
+		Word fetchOr(size_t word, Word value){ return mWords[word].fetch_or(value, std::memory_order_relaxed); }
+
+		static int countTrailingZeros(Word word);
+
+	private:
+		int mSize[3] = { 0, 0, 0 };
+		size_t mRowWords = 0;
+		size_t mCapacity = 0;
+		std::unique_ptr<std::atomic<Word>[]> mWords;
+	};
+}
+
+#endif
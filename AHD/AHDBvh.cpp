@@ -0,0 +1,358 @@
+#include "AHDBvh.h"
+#include "AHDOverlap.h"
+#include <algorithm>
+#include <deque>
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	const unsigned int MIN_PARALLEL = 4096;
+	//one traversal step against one triangle test
+	const float TRAVERSAL_COST = 1.0f;
+
+	float getArea(const AABB& aabb)
+	{
+		Vector3 size = aabb.getSize();
+		return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	//twice the signed area of u, v, p in the yz plane
+	inline float orient(const Vector3& u, const Vector3& v, const Vector3& p)
+	{
+		return (v.y - u.y) * (p.z - u.z) - (v.z - u.z) * (p.y - u.y);
+	}
+
+	//an edge shared by two triangles runs both ways, only one way owns it
+	inline bool covers(float w, const Vector3& u, const Vector3& v)
+	{
+		float dz = v.z - u.z;
+		return w > 0 || (w == 0 && (dz > 0 || (dz == 0 && v.y < u.y)));
+	}
+}
+
+void TriangleBvh::build(ThreadPool& pool, const Vector3* corners, size_t triangles)
+{
+	clear();
+	if (triangles == 0)
+		return;
+
+	mBounds.resize(triangles);
+	mCentroids.resize(triangles);
+	mTriangles.resize(triangles);
+	pool.parallelFor(triangles, 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			AABB bound;
+			for (int k = 0; k < 3; ++k)
+				bound.merge(corners[i * 3 + k]);
+			mBounds[i] = bound;
+			mCentroids[i] = bound.getCenter();
+			mTriangles[i] = (unsigned int)i;
+		}
+	});
+
+	//the widest ranges first, until every thread has a few subtrees to take
+	mNodes.resize(1);
+	Range root = { 0, 0, (unsigned int)triangles };
+	std::deque<Range> pending(1, root);
+	std::vector<Range> subtrees;
+	size_t target = pool.getThreadCount() * 4;
+	while (!pending.empty())
+	{
+		Range range = pending.front();
+		pending.pop_front();
+		if (range.end - range.begin < MIN_PARALLEL || pending.size() + subtrees.size() + 1 >= target)
+		{
+			subtrees.push_back(range);
+			continue;
+		}
+
+		Range children[2];
+		if (split(range, mNodes, children))
+		{
+			pending.push_back(children[0]);
+			pending.push_back(children[1]);
+		}
+	}
+
+	std::sort(subtrees.begin(), subtrees.end(), [](const Range& a, const Range& b)
+	{
+		return a.end - a.begin > b.end - b.begin;
+	});
+	std::vector<std::vector<Node>> locals(subtrees.size());
+	pool.parallelSteal(subtrees.size(), [&](size_t i, size_t thread)
+	{
+		Range range = { 0, subtrees[i].begin, subtrees[i].end };
+		locals[i].resize(1);
+		buildSubtree(range, locals[i]);
+	});
+
+	//the root of a subtree goes where its range was, the rest is appended
+	for (size_t i = 0; i < subtrees.size(); ++i)
+	{
+		unsigned int base = (unsigned int)mNodes.size() - 1;
+		for (size_t j = 0; j < locals[i].size(); ++j)
+		{
+			Node node = locals[i][j];
+			if (node.count == 0)
+				node.first += base;
+			if (j == 0)
+				mNodes[subtrees[i].node] = node;
+			else
+				mNodes.push_back(node);
+		}
+	}
+
+	mCorners.resize(triangles * 3);
+	pool.parallelFor(triangles, 4096, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+				mCorners[i * 3 + k] = corners[mTriangles[i] * 3 + k];
+		}
+	});
+
+	std::vector<AABB>().swap(mBounds);
+	std::vector<Vector3>().swap(mCentroids);
+}
+
+void TriangleBvh::clear()
+{
+	std::vector<Node>().swap(mNodes);
+	std::vector<unsigned int>().swap(mTriangles);
+	std::vector<Vector3>().swap(mCorners);
+}
+
+bool TriangleBvh::split(const Range& range, std::vector<Node>& nodes, Range* children)
+{
+	AABB bound;
+	AABB centroids;
+	for (unsigned int i = range.begin; i < range.end; ++i)
+	{
+		bound.merge(mBounds[mTriangles[i]]);
+		centroids.merge(mCentroids[mTriangles[i]]);
+	}
+
+	Node node;
+	for (int i = 0; i < 3; ++i)
+	{
+		node.min[i] = bound.getMin()[i];
+		node.max[i] = bound.getMax()[i];
+	}
+	node.first = range.begin;
+	node.count = range.end - range.begin;
+
+	Vector3 extent = centroids.getSize();
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	unsigned int* first = mTriangles.data() + range.begin;
+	unsigned int* last = mTriangles.data() + range.end;
+	unsigned int* middle = nullptr;
+	if (extent[axis] > 0 && node.count > 2)
+	{
+		struct Bin
+		{
+			AABB bound;
+			unsigned int count;
+		};
+		Bin bins[BINS];
+		for (int b = 0; b < BINS; ++b)
+			bins[b].count = 0;
+
+		float low = centroids.getMin()[axis];
+		float scale = BINS / extent[axis];
+		auto getBin = [&](unsigned int t)
+		{
+			return std::min((int)((mCentroids[t][axis] - low) * scale), BINS - 1);
+		};
+		for (unsigned int* i = first; i != last; ++i)
+		{
+			Bin& bin = bins[getBin(*i)];
+			++bin.count;
+			bin.bound.merge(mBounds[*i]);
+		}
+
+		//cost of splitting after bin b, from both ends
+		float rightArea[BINS];
+		unsigned int rightCount[BINS];
+		AABB sweep;
+		unsigned int count = 0;
+		for (int b = BINS - 1; b > 0; --b)
+		{
+			sweep.merge(bins[b].bound);
+			count += bins[b].count;
+			rightArea[b] = getArea(sweep);
+			rightCount[b] = count;
+		}
+
+		float best = 0;
+		int bestBin = -1;
+		sweep.setNull();
+		count = 0;
+		for (int b = 0; b + 1 < BINS; ++b)
+		{
+			sweep.merge(bins[b].bound);
+			count += bins[b].count;
+			if (count == 0 || rightCount[b + 1] == 0)
+				continue;
+			float cost = getArea(sweep) * count + rightArea[b + 1] * rightCount[b + 1];
+			if (bestBin < 0 || cost < best)
+			{
+				best = cost;
+				bestBin = b;
+			}
+		}
+
+		float area = getArea(bound);
+		if (node.count <= MAX_LEAF && (bestBin < 0 || best + area * TRAVERSAL_COST >= area * node.count))
+		{
+			nodes[range.node] = node;
+			return false;
+		}
+		if (bestBin >= 0)
+			middle = std::partition(first, last, [&](unsigned int t){ return getBin(t) <= bestBin; });
+	}
+	else if (node.count <= MAX_LEAF)
+	{
+		nodes[range.node] = node;
+		return false;
+	}
+
+	//centroids all in one place, halves of any order
+	if (!middle)
+	{
+		middle = first + node.count / 2;
+		std::nth_element(first, middle, last, [&](unsigned int a, unsigned int b){ return mCentroids[a][axis] < mCentroids[b][axis]; });
+	}
+
+	node.first = (unsigned int)nodes.size();
+	node.count = 0;
+	nodes[range.node] = node;
+	nodes.resize(nodes.size() + 2);
+	unsigned int mid = (unsigned int)(middle - mTriangles.data());
+	Range left = { node.first, range.begin, mid };
+	Range right = { node.first + 1, mid, range.end };
+	children[0] = left;
+	children[1] = right;
+	return true;
+}
+
+void TriangleBvh::buildSubtree(const Range& range, std::vector<Node>& nodes)
+{
+	std::vector<Range> stack(1, range);
+	while (!stack.empty())
+	{
+		Range r = stack.back();
+		stack.pop_back();
+		Range children[2];
+		if (split(r, nodes, children))
+		{
+			stack.push_back(children[1]);
+			stack.push_back(children[0]);
+		}
+	}
+}
+
+void TriangleBvh::query(const AABB& box, std::vector<unsigned int>& triangles, bool exact)const
+{
+	if (mNodes.empty() || !box.isValid())
+		return;
+
+	const Vector3& low = box.getMin();
+	const Vector3& high = box.getMax();
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty())
+	{
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		bool overlap = true;
+		for (int i = 0; i < 3; ++i)
+			overlap = overlap && node.min[i] <= high[i] && node.max[i] >= low[i];
+		if (!overlap)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+			continue;
+		}
+
+		for (unsigned int t = node.first; t < node.first + node.count; ++t)
+		{
+			const Vector3* p = mCorners.data() + t * 3;
+			AABB bound;
+			for (int k = 0; k < 3; ++k)
+				bound.merge(p[k]);
+			bool hit = true;
+			for (int i = 0; i < 3; ++i)
+				hit = hit && bound.getMin()[i] <= high[i] && bound.getMax()[i] >= low[i];
+
+			//the box at the origin, so the test is of the single box (0, 0, 0)
+			if (hit && exact)
+			{
+				Vector3 shifted[3] = { p[0] - low, p[1] - low, p[2] - low };
+				TriangleBoxTest test;
+				test.setup(shifted, high - low);
+				int zero = 0;
+				unsigned char result = 0;
+				hit = Overlap::scalar(test, &zero, &zero, &zero, 1, &result) != 0;
+			}
+			if (hit)
+				triangles.push_back(mTriangles[t]);
+		}
+	}
+}
+
+bool TriangleBvh::isInside(const Vector3& point)const
+{
+	if (mNodes.empty())
+		return false;
+
+	bool inside = false;
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty())
+	{
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		if (node.max[0] < point.x || node.min[1] > point.y || node.max[1] < point.y || node.min[2] > point.z || node.max[2] < point.z)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+			continue;
+		}
+
+		for (unsigned int t = node.first; t < node.first + node.count; ++t)
+		{
+			//counter clockwise in yz, triangles parallel to the ray don't count
+			Vector3 a = mCorners[t * 3];
+			Vector3 b = mCorners[t * 3 + 1];
+			Vector3 c = mCorners[t * 3 + 2];
+			float area = orient(a, b, c);
+			if (area == 0)
+				continue;
+			if (area < 0)
+			{
+				std::swap(b, c);
+				area = -area;
+			}
+
+			float w0 = orient(b, c, point);
+			float w1 = orient(c, a, point);
+			float w2 = orient(a, b, point);
+			if (!covers(w0, b, c) || !covers(w1, c, a) || !covers(w2, a, b))
+				continue;
+			if ((w0 * a.x + w1 * b.x + w2 * c.x) / area > point.x)
+				inside = !inside;
+		}
+	}
+	return inside;
+}
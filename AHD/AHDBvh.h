@@ -0,0 +1,66 @@
+#ifndef _AHDBvh_H_
+#define _AHDBvh_H_
+
+#include "AHDUtils.h"
+#include "AHDThreadPool.h"
+#include <vector>
+
+namespace AHD
+{
+	//bounding volume hierarchy over triangles, split by the surface area heuristic evaluated
+	//in BINS buckets of the centroids. the nodes are one flat array, the two children of an
+	//inner node next to each other, and the corners are kept in leaf order so a leaf reads
+	//one contiguous block. the top levels are split on the calling thread until there are
+	//enough subtrees for every thread, the subtrees are then built in parallel
+	class TriangleBvh
+	{
+	public:
+		static const int BINS = 16;
+		static const unsigned int MAX_LEAF = 8;
+
+		struct Node
+		{
+			float min[3];
+			float max[3];
+			unsigned int first;//left child of an inner node, first triangle of a leaf
+			unsigned int count;//triangles of a leaf, 0 for an inner node
+		};
+
+		//corners holds 3 per triangle
+		void build(ThreadPool& pool, const Vector3* corners, size_t triangles);
+		void clear();
+		bool isEmpty()const{ return mNodes.empty(); }
+		const std::vector<Node>& getNodes()const{ return mNodes; }
+		size_t getTriangleCount()const{ return mTriangles.size(); }
+
+		//appends the triangles (in the numbering given to build) that touch box, exactly or
+		//only by their bound
+		void query(const AABB& box, std::vector<unsigned int>& triangles, bool exact = true)const;
+		//parity of the triangles a ray from point along +x crosses, meshes have to be watertight
+		bool isInside(const Vector3& point)const;
+
+	private:
+		struct Range
+		{
+			unsigned int node;
+			unsigned int begin;
+			unsigned int end;
+		};
+
+		//fills nodes[range.node] and either makes it a leaf or appends its two children to
+		//nodes and returns true with their ranges in children
+		bool split(const Range& range, std::vector<Node>& nodes, Range* children);
+		void buildSubtree(const Range& range, std::vector<Node>& nodes);
+
+	private:
+		std::vector<Node> mNodes;
+		std::vector<unsigned int> mTriangles;//leaf order to build order
+		std::vector<Vector3> mCorners;//leaf order
+
+		//only while building
+		std::vector<AABB> mBounds;
+		std::vector<Vector3> mCentroids;
+	};
+}
+
+#endif
@@ -0,0 +1,56 @@
+#include "AHDCompactIndices.h"
+#include <algorithm>
+#include <string.h>
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+void CompactIndices::build(const void* indexes, size_t count, size_t stride)
+{
+	clear();
+	mCount = count;
+
+	const size_t MESHLET_SIZE = MESHLET_TRIANGLES * 3;
+	std::vector<unsigned int> meshlet;
+	for (size_t begin = 0; begin < count; begin += MESHLET_SIZE)
+	{
+		size_t size = std::min(MESHLET_SIZE, count - begin);
+		meshlet.resize(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (stride == 2)
+				meshlet[i] = ((const unsigned short*)indexes)[begin + i];
+			else
+				meshlet[i] = ((const unsigned int*)indexes)[begin + i];
+		}
+
+		Meshlet m;
+		m.base = *std::min_element(meshlet.begin(), meshlet.end());
+		unsigned int range = *std::max_element(meshlet.begin(), meshlet.end()) - m.base;
+		m.width = range < 0x100 ? 1 : (range < 0x10000 ? 2 : 4);
+		m.offset = (unsigned int)((mData.size() + m.width - 1) / m.width * m.width);
+		mData.resize(m.offset + size * m.width);
+
+		unsigned char* data = mData.data() + m.offset;
+		for (size_t i = 0; i < size; ++i)
+		{
+			unsigned int offset = meshlet[i] - m.base;
+			switch (m.width)
+			{
+			case 1: data[i] = (unsigned char)offset; break;
+			case 2: ((unsigned short*)data)[i] = (unsigned short)offset; break;
+			default: ((unsigned int*)data)[i] = offset; break;
+			}
+		}
+		mMeshlets.push_back(m);
+	}
+}
+
+void CompactIndices::clear()
+{
+	std::vector<Meshlet>().swap(mMeshlets);
+	std::vector<unsigned char>().swap(mData);
+	mCount = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _AHDCompactIndices_H_
+#define _AHDCompactIndices_H_
+
+#include <stddef.h>
+#include <vector>
+
+namespace AHD
+{
+	//triangle indices in meshlets of MESHLET_TRIANGLES, each one stored as offsets from its
+	//smallest index in 1, 2 or 4 bytes, whichever holds its range. meshes with locality
+	//mostly take 1 or 2 bytes an index and any index is still one lookup away
+	class CompactIndices
+	{
+	public:
+		static const size_t MESHLET_TRIANGLES = 64;
+
+		//stride 2 or 4
+		void build(const void* indexes, size_t count, size_t stride);
+		void clear();
+		size_t getCount()const{ return mCount; }
+		//bytes held
+		size_t getSize()const{ return mData.size() + mMeshlets.size() * sizeof(Meshlet); }
+
+		size_t get(size_t i)const
+		{
+			const Meshlet& m = mMeshlets[i / (MESHLET_TRIANGLES * 3)];
+			const unsigned char* data = mData.data() + m.offset;
+			size_t k = i % (MESHLET_TRIANGLES * 3);
+			switch (m.width)
+			{
+			case 1: return m.base + data[k];
+			case 2: return m.base + ((const unsigned short*)data)[k];
+			default: return m.base + ((const unsigned int*)data)[k];
+			}
+		}
+
+	private:
+		struct Meshlet
+		{
+			unsigned int base;
+			unsigned int offset;//into mData, aligned to width
+			unsigned int width;
+		};
+
+		std::vector<Meshlet> mMeshlets;
+		std::vector<unsigned char> mData;
+		size_t mCount = 0;
+	};
+}
+
+#endif
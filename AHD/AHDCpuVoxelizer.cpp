@@ -0,0 +1,1245 @@
+#include "AHDCpuVoxelizer.h"
+#include "AHDVertex.h"
+#include "AHD.h"
+#include "AHDMorton.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string.h>
+#include <math.h>
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	//same as the hardware rasterizer
+	const long long SUBPIXEL_BITS = 8;
+	const long long SUBPIXEL = 1 << SUBPIXEL_BITS;
+	const long long HALF_PIXEL = SUBPIXEL / 2;
+
+	const size_t TRIANGLE_GRAIN = 64;
+	const size_t ROW_GRAIN = 256;
+	const size_t WORD_GRAIN = 1024;
+	const int FRACTION_STEPS = 1024;
+
+	//instances with equal keys rasterize alike up to a shift by whole voxels
+	struct InstanceKey
+	{
+		float linear[9];
+		int fraction[3];//of the translation in voxels, in 1 / FRACTION_STEPS
+
+		bool operator < (const InstanceKey& rhs)const{ return memcmp(this, &rhs, sizeof(InstanceKey)) < 0; }
+	};
+
+	inline long long floorDiv(long long a, long long b)
+	{
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	inline long long ceilDiv(long long a, long long b)
+	{
+		return -floorDiv(-a, b);
+	}
+
+	inline int clamp(int v, int low, int high)
+	{
+		return v < low ? low : (v > high ? high : v);
+	}
+
+	//visits the pixel centers in [beginU, endU] x [beginV, endV] covered by the triangle
+	//projected on (u, v), visit(i, j, barycentric). positions are snapped to sub pixels
+	//and tested with the top left rule, so a shared edge belongs to exactly one side.
+	template<class Visitor>
+	void scan(const Vector3* p, int u, int v, long long beginU, long long endU, long long beginV, long long endV, const Visitor& visit)
+	{
+		long long su[3], sv[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			su[i] = (long long)floor(p[i][u] * SUBPIXEL + 0.5f);
+			sv[i] = (long long)floor(p[i][v] * SUBPIXEL + 0.5f);
+		}
+
+		int order[3] = { 0, 1, 2 };
+		long long area = (su[1] - su[0]) * (sv[2] - sv[0]) - (sv[1] - sv[0]) * (su[2] - su[0]);
+		if (area == 0)
+			return;
+		if (area < 0)
+		{
+			std::swap(order[1], order[2]);
+			area = -area;
+		}
+
+		long long minU = std::min(su[0], std::min(su[1], su[2]));
+		long long maxU = std::max(su[0], std::max(su[1], su[2]));
+		long long minV = std::min(sv[0], std::min(sv[1], sv[2]));
+		long long maxV = std::max(sv[0], std::max(sv[1], sv[2]));
+
+		beginU = std::max(ceilDiv(minU - HALF_PIXEL, SUBPIXEL), beginU);
+		endU = std::min(floorDiv(maxU - HALF_PIXEL, SUBPIXEL), endU);
+		beginV = std::max(ceilDiv(minV - HALF_PIXEL, SUBPIXEL), beginV);
+		endV = std::min(floorDiv(maxV - HALF_PIXEL, SUBPIXEL), endV);
+		if (beginU > endU || beginV > endV)
+			return;
+
+		//edge k goes from order[k] to order[k + 1], its value weights the opposite vertex
+		long long stepU[3], stepV[3], row[3], bias[3];
+		int weighted[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			int a = order[k];
+			int b = order[(k + 1) % 3];
+			long long du = su[b] - su[a];
+			long long dv = sv[b] - sv[a];
+			stepU[k] = -dv * SUBPIXEL;
+			stepV[k] = du * SUBPIXEL;
+			row[k] = du * (beginV * SUBPIXEL + HALF_PIXEL - sv[a]) - dv * (beginU * SUBPIXEL + HALF_PIXEL - su[a]);
+			//top left rule
+			bias[k] = (dv < 0 || (dv == 0 && du > 0)) ? 0 : 1;
+			weighted[k] = order[(k + 2) % 3];
+		}
+
+		float invArea = 1.0f / (float)area;
+		for (long long j = beginV; j <= endV; ++j)
+		{
+			long long e[3] = { row[0], row[1], row[2] };
+			for (long long i = beginU; i <= endU; ++i, e[0] += stepU[0], e[1] += stepU[1], e[2] += stepU[2])
+			{
+				if (e[0] < bias[0] || e[1] < bias[1] || e[2] < bias[2])
+					continue;
+
+				float l[3];
+				for (int k = 0; k < 3; ++k)
+					l[weighted[k]] = e[k] * invArea;
+				visit((int)i, (int)j, l);
+			}
+
+			for (int k = 0; k < 3; ++k)
+				row[k] += stepV[k];
+		}
+	}
+}
+
+CpuVoxelizer::CpuVoxelizer(ThreadPool& pool)
+	:mPool(pool)
+{
+}
+
+void CpuVoxelizer::addTexture(const std::string& name, size_t width, size_t height, const void* data)
+{
+	mTextures[name].build(width, height, data);
+}
+
+bool CpuVoxelizer::hasTexture(const std::string& name)const
+{
+	return mTextures.find(name) != mTextures.end();
+}
+
+void CpuVoxelizer::setTileSize(int size)
+{
+	mTileSize = std::max(1, size);
+}
+
+void CpuVoxelizer::load(const Grid& grid, size_t count, VoxelResource** res, int slabSize)
+{
+	mGrid = grid;
+	mStamps.clear();
+	mCopies.clear();
+	if (mOverlap == nullptr)
+		mOverlap = Overlap::getKernel();
+
+	std::vector<Source> sources;
+	std::vector<Source> masters;
+	for (size_t i = 0; i < count; ++i)
+	{
+		VoxelResource* r = res[i];
+		size_t vertices = r->isIndexed() ? r->mIndexCount : r->mVertexCount;
+		if (!r->mVertices || vertices < 3)
+			continue;
+
+		auto end = r->mDesc.end();
+		auto pos = r->mDesc.find(S_POSITION);
+		auto color = r->mDesc.find(S_COLOR);
+		auto uv = r->mDesc.find(S_TEXCOORD);
+
+		Source src;
+		src.res = r;
+		src.texture = nullptr;
+		src.pos = &pos->second;
+		src.color = color != end ? &color->second : nullptr;
+		src.uv = uv != end ? &uv->second : nullptr;
+		src.first = 0;
+		src.triangles = vertices / 3;
+		src.material = r->mMaterial;
+
+		//same as gpu, texture is only sampled when there is a texcoord
+		if (uv != end && !r->mTexture.empty())
+		{
+			auto tex = mTextures.find(r->mTexture);
+			if (tex != mTextures.end())
+				src.texture = &tex->second;
+		}
+
+		if (r->mInstances.empty())
+			sources.push_back(src);
+		else
+			instance(src, r->mInstances, sources, masters);
+	}
+
+	setupSources(sources, grid, mTriangles);
+	if (!masters.empty())
+	{
+		std::vector<Triangle> triangles;
+		setupSources(masters, grid, triangles);
+		rasterizeStamps(masters, triangles);
+	}
+
+	//slabs are whole tiles, a triangle goes to every slab its tiles reach
+	int tiles = (grid.size[2] + mTileSize - 1) / mTileSize;
+	int slabTiles = clamp((std::max(slabSize, 1) + mTileSize - 1) / mTileSize, 1, tiles);
+	size_t slabs = (tiles + slabTiles - 1) / slabTiles;
+	mSlabSize = slabTiles * mTileSize;
+	mSlabOffsets.assign(slabs + 1, 0);
+	for (auto& tri : mTriangles)
+	{
+		for (int i = tri.tileMin[2] / slabTiles; i <= tri.tileMax[2] / slabTiles; ++i)
+			++mSlabOffsets[i + 1];
+	}
+	for (size_t i = 0; i < slabs; ++i)
+		mSlabOffsets[i + 1] += mSlabOffsets[i];
+
+	mSlabs.resize(mSlabOffsets[slabs]);
+	std::vector<unsigned int> cursors(mSlabOffsets.begin(), mSlabOffsets.end() - 1);
+	for (size_t n = 0; n < mTriangles.size(); ++n)
+	{
+		for (int i = mTriangles[n].tileMin[2] / slabTiles; i <= mTriangles[n].tileMax[2] / slabTiles; ++i)
+			mSlabs[cursors[i]++] = (unsigned int)n;
+	}
+}
+
+void CpuVoxelizer::voxelizeSlab(size_t slab)
+{
+	//the slab is a grid of its own, offset along z
+	int base = getSlabOffset(slab);
+	int firstTile = base / mTileSize;
+	Grid grid = mGrid;
+	grid.offset[2] += base;
+	grid.size[2] = std::min(mSlabSize, mGrid.size[2] - base);
+
+	int tiles[3];
+	for (int i = 0; i < 3; ++i)
+		tiles[i] = (grid.size[i] + mTileSize - 1) / mTileSize;
+	bin(mSlabs.data() + mSlabOffsets[slab], mSlabs.data() + mSlabOffsets[slab + 1], tiles, firstTile);
+
+	bool solid = mFillMode != Voxelizer::FM_SURFACE;
+	bool parity = mFillMode == Voxelizer::FM_SOLID_PARITY;
+	if (solid)
+		mSolid.resize(grid.size[0], grid.size[1], grid.size[2]);
+	if (solid && !parity)
+		mSurface.resize(grid.size[0], grid.size[1], grid.size[2]);
+
+	//a tile costs about its triangles plus their area in it. crowded tiles are cut into
+	//several tasks so one of them doesn't hold up the slab, the bits are set atomically
+	std::vector<unsigned int> busy;
+	for (size_t i = 0; i + 1 < mBinOffsets.size(); ++i)
+	{
+		if (mBinOffsets[i + 1] != mBinOffsets[i])
+			busy.push_back((unsigned int)i);
+	}
+	const float TRIANGLE_COST = 16;
+	float tileArea = (float)mTileSize * mTileSize;
+	std::vector<float> costs(busy.size());
+	mPool.parallelFor(busy.size(), 16, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t n = begin; n < end; ++n)
+		{
+			//binning order depends on the threads, keep the mesh order for locality
+			unsigned int* first = mBins.data() + mBinOffsets[busy[n]];
+			unsigned int* last = mBins.data() + mBinOffsets[busy[n] + 1];
+			std::sort(first, last);
+			float cost = 0;
+			for (unsigned int* i = first; i != last; ++i)
+				cost += std::min(mTriangles[*i].area, tileArea) + TRIANGLE_COST;
+			costs[n] = cost;
+		}
+	});
+
+	const float TASK_COST = tileArea * 8;
+	std::vector<Task> tasks;
+	for (size_t n = 0; n < busy.size(); ++n)
+	{
+		size_t first = mBinOffsets[busy[n]];
+		size_t count = mBinOffsets[busy[n] + 1] - first;
+		size_t parts = std::min(std::max((size_t)ceil(costs[n] / TASK_COST), (size_t)1), count);
+		for (size_t i = 0; i < parts; ++i)
+		{
+			Task task = { busy[n], (unsigned int)(first + count * i / parts), (unsigned int)(first + count * (i + 1) / parts), costs[n] / parts };
+			tasks.push_back(task);
+		}
+	}
+	//costly tasks first, the cheap ones are left over for stealing
+	std::sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b){ return a.cost > b.cost; });
+
+	mTileStats.resize(tasks.size());
+	mFragments.resize(mPool.getThreadCount());
+	for (auto& i : mFragments)
+		i.clear();
+	std::vector<Candidates> candidates(mPool.getThreadCount());
+	mPool.parallelSteal(tasks.size(), [&](size_t task, size_t thread)
+	{
+		Timer timer;
+		unsigned int index = tasks[task].tile;
+		int pos[3] = { (int)(index % tiles[0]), (int)(index / tiles[0] % tiles[1]), (int)(index / tiles[0] / tiles[1]) };
+
+		Tile tile;
+		for (int i = 0; i < 3; ++i)
+		{
+			tile.min[i] = pos[i] * mTileSize;
+			tile.max[i] = std::min(tile.min[i] + mTileSize, grid.size[i]);
+		}
+
+		unsigned int* first = mBins.data() + tasks[task].first;
+		unsigned int* last = mBins.data() + tasks[task].last;
+
+		auto& out = mFragments[thread];
+		size_t before = out.size();
+		if (mRasterMode == Voxelizer::RM_CENTER)
+		{
+			for (unsigned int* i = first; i != last; ++i)
+				rasterize(mTriangles[*i], grid, tile, out);
+		}
+		else
+		{
+			for (unsigned int* i = first; i != last; ++i)
+				rasterizeConservative(mTriangles[*i], grid, tile, candidates[thread], out);
+		}
+		if (parity)
+		{
+			for (unsigned int* i = first; i != last; ++i)
+				markParity(mTriangles[*i], grid, tile);
+		}
+		else if (solid)
+		{
+			for (unsigned int* i = first; i != last; ++i)
+				markWalls(mTriangles[*i], grid, tile);
+		}
+
+		TileStat& stat = mTileStats[task];
+		for (int i = 0; i < 3; ++i)
+			stat.pos[i] = pos[i];
+		stat.pos[2] += firstTile;
+		stat.triangles = last - first;
+		stat.fragments = out.size() - before;
+		stat.thread = thread;
+		stat.time = timer.getMilliseconds();
+	});
+
+	//instances sharing a stamp, shifted into the slab
+	mPool.parallelFor(mCopies.size(), 1, [&](size_t begin, size_t end, size_t thread)
+	{
+		auto& out = mFragments[thread];
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Stamp& stamp = mStamps[mCopies[i].stamp];
+			int shift[3];
+			for (int k = 0; k < 3; ++k)
+				shift[k] = stamp.offset[k] + mCopies[i].shift[k] - grid.offset[k];
+			if (shift[2] >= grid.size[2] || shift[2] + stamp.size[2] <= 0)
+				continue;
+
+			int pos[3];
+			for (auto& fragment : stamp.fragments)
+			{
+				fragment.key.getPos(pos);
+				bool inside = true;
+				for (int k = 0; k < 3; ++k)
+				{
+					pos[k] += shift[k];
+					inside &= pos[k] >= 0 && pos[k] < grid.size[k];
+				}
+				if (!inside)
+					continue;
+
+				Fragment copy = fragment;
+				copy.key = VoxelKey::make(pos);
+				out.push_back(copy);
+			}
+		}
+	});
+
+	if (solid)
+		fill();
+}
+
+size_t CpuVoxelizer::getSpans(std::vector<FragmentSpan>& spans)const
+{
+	size_t offset = 0;
+	for (auto& i : mFragments)
+	{
+		for (size_t c = 0; c < i.getChunkCount(); ++c)
+		{
+			FragmentSpan span = { i.getChunk(c), i.getChunkSize(c), offset };
+			spans.push_back(span);
+			offset += span.size;
+		}
+	}
+	return offset;
+}
+
+void CpuVoxelizer::instance(const Source& src, const std::vector<Matrix4>& instances, std::vector<Source>& sources, std::vector<Source>& masters)
+{
+	Source direct = src;
+	//the solid fills mark the triangles themselves, every instance is rasterized
+	if (mFillMode != Voxelizer::FM_SURFACE)
+	{
+		direct.worlds = instances;
+		sources.push_back(direct);
+		return;
+	}
+
+	//same linear part and same fraction of a voxel in translation
+	std::map<InstanceKey, std::vector<size_t>> groups;
+	for (size_t i = 0; i < instances.size(); ++i)
+	{
+		const Matrix4& m = instances[i];
+		InstanceKey key;
+		for (int r = 0; r < 3; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+				key.linear[r * 3 + c] = m.m[r][c];
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			double v = (double)m.m[3][k] * mGrid.scale[k];
+			key.fraction[k] = (int)floor((v - floor(v)) * FRACTION_STEPS + 0.5) % FRACTION_STEPS;
+		}
+		groups[key].push_back(i);
+	}
+
+	for (auto& group : groups)
+	{
+		const Matrix4& master = instances[group.second[0]];
+		if (group.second.size() == 1)
+		{
+			direct.worlds.push_back(master);
+			continue;
+		}
+
+		Source stamp = src;
+		stamp.worlds.assign(1, master);
+		masters.push_back(stamp);
+		for (auto i : group.second)
+		{
+			Copy copy;
+			copy.stamp = mStamps.size();
+			for (int k = 0; k < 3; ++k)
+				copy.shift[k] = (int)floor(((double)instances[i].m[3][k] - master.m[3][k]) * mGrid.scale[k] + 0.5);
+			mCopies.push_back(copy);
+		}
+		mStamps.push_back(Stamp());
+	}
+
+	if (!direct.worlds.empty())
+		sources.push_back(direct);
+}
+
+void CpuVoxelizer::setupSources(std::vector<Source>& sources, const Grid& grid, std::vector<Triangle>& triangles)
+{
+	size_t total = 0;
+	for (auto& i : sources)
+	{
+		i.first = total;
+		total += i.triangles * std::max<size_t>(i.worlds.size(), 1);
+	}
+
+	//the instances of a triangle are next to each other, so a run only fetches it once
+	triangles.resize(total);
+	mPool.parallelFor(total, TRIANGLE_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		auto src = std::upper_bound(sources.begin(), sources.end(), begin,
+			[](size_t index, const Source& s){ return index < s.first; }) - 1;
+
+		Vertex vertices[3];
+		for (size_t i = begin; i < end; ++i)
+		{
+			while (src + 1 != sources.end() && (src + 1)->first <= i)
+				++src;
+
+			size_t instances = std::max<size_t>(src->worlds.size(), 1);
+			size_t instance = (i - src->first) % instances;
+			if (instance == 0 || i == begin)
+				fetch(*src, (i - src->first) / instances, vertices);
+
+			Triangle& tri = triangles[i];
+			for (int v = 0; v < 3; ++v)
+			{
+				tri.vertices[v] = vertices[v];
+				if (!src->worlds.empty())
+					tri.vertices[v].pos = src->worlds[instance].transformAffine(vertices[v].pos);
+			}
+			tri.texture = src->texture;
+			tri.material = src->material;
+			setup(tri, grid);
+		}
+	});
+}
+
+void CpuVoxelizer::rasterizeStamps(const std::vector<Source>& masters, const std::vector<Triangle>& triangles)
+{
+	//each stamp is rasterized in a grid around its own bound, rasterize clamps the depth into mGrid
+	Grid whole = mGrid;
+	mFragments.resize(mPool.getThreadCount());
+	std::vector<Candidates> candidates(mPool.getThreadCount());
+	for (size_t s = 0; s < mStamps.size(); ++s)
+	{
+		Stamp& stamp = mStamps[s];
+		const Triangle* first = triangles.data() + masters[s].first;
+		size_t count = masters[s].triangles;
+
+		AABB bound;
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (int v = 0; v < 3; ++v)
+				bound.merge(first[i].vertices[v].pos);
+		}
+
+		Tile tile;
+		for (int k = 0; k < 3; ++k)
+		{
+			stamp.offset[k] = (int)floor(bound.getMin()[k]) - 1;
+			stamp.size[k] = (int)floor(bound.getMax()[k]) + 2 - stamp.offset[k];
+			mGrid.offset[k] = stamp.offset[k];
+			mGrid.size[k] = stamp.size[k];
+			tile.min[k] = 0;
+			tile.max[k] = stamp.size[k];
+		}
+
+		for (auto& i : mFragments)
+			i.clear();
+		mPool.parallelFor(count, TRIANGLE_GRAIN, [&](size_t begin, size_t end, size_t thread)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				if (mRasterMode == Voxelizer::RM_CENTER)
+					rasterize(first[i], mGrid, tile, mFragments[thread]);
+				else
+					rasterizeConservative(first[i], mGrid, tile, candidates[thread], mFragments[thread]);
+			}
+		});
+
+		std::vector<FragmentSpan> spans;
+		stamp.fragments.resize(getSpans(spans));
+		for (auto& i : spans)
+			std::copy(i.data, i.data + i.size, stamp.fragments.begin() + i.offset);
+	}
+	mGrid = whole;
+}
+
+void CpuVoxelizer::bin(const unsigned int* first, const unsigned int* last, const int* tiles, int firstTile)
+{
+	size_t count = (size_t)tiles[0] * tiles[1] * tiles[2];
+	std::unique_ptr<std::atomic<unsigned int>[]> cursors(new std::atomic<unsigned int>[count]);
+	for (size_t i = 0; i < count; ++i)
+		cursors[i].store(0, std::memory_order_relaxed);
+
+	//count, offset, then fill
+	size_t size = last - first;
+	std::vector<Candidates> candidates(mPool.getThreadCount());
+	mPool.parallelFor(size, TRIANGLE_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		std::vector<size_t> overlapped;
+		for (size_t i = begin; i < end; ++i)
+		{
+			overlapTiles(mTriangles[first[i]], tiles, firstTile, candidates[thread], overlapped);
+			for (auto t : overlapped)
+				cursors[t].fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	mBinOffsets.resize(count + 1);
+	mBinOffsets[0] = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		mBinOffsets[i + 1] = mBinOffsets[i] + cursors[i].load(std::memory_order_relaxed);
+		cursors[i].store(mBinOffsets[i], std::memory_order_relaxed);
+	}
+	mBins.resize(mBinOffsets[count]);
+
+	mPool.parallelFor(size, TRIANGLE_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		std::vector<size_t> overlapped;
+		for (size_t i = begin; i < end; ++i)
+		{
+			overlapTiles(mTriangles[first[i]], tiles, firstTile, candidates[thread], overlapped);
+			for (auto t : overlapped)
+				mBins[cursors[t].fetch_add(1, std::memory_order_relaxed)] = first[i];
+		}
+	});
+}
+
+void CpuVoxelizer::overlapTiles(const Triangle& tri, const int* tiles, int firstTile, Candidates& candidates, std::vector<size_t>& out)const
+{
+	//tileMin and tileMax are in tiles of the whole grid
+	int begin[3], end[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		begin[i] = tri.tileMin[i];
+		end[i] = tri.tileMax[i];
+	}
+	begin[2] = std::max(begin[2] - firstTile, 0);
+	end[2] = std::min(end[2] - firstTile, tiles[2] - 1);
+
+	out.clear();
+	if (begin[0] == end[0] && begin[1] == end[1] && begin[2] == end[2])
+	{
+		out.push_back(begin[0] + (begin[1] + (size_t)begin[2] * tiles[1]) * tiles[0]);
+		return;
+	}
+
+	//a bound over several tiles, a long diagonal triangle only touches a few of them.
+	//the tiles are tested a little wider than they are, the snapped rasterizer may land a hair
+	//outside the triangle and parity marks up to a voxel past it in x
+	const float MARGIN = 1.0f / 64;
+	Vector3 low(MARGIN, MARGIN, MARGIN);
+	if (mFillMode == Voxelizer::FM_SOLID_PARITY)
+		low.x += 1.0f;
+	Vector3 p[3];
+	for (int i = 0; i < 3; ++i)
+		p[i] = tri.vertices[i].pos + low;
+
+	//coarse to fine, blocks of 2^level tiles along each axis are tested and only the ones
+	//the triangle overlaps are split, so the cost follows its surface instead of its bound
+	begin[2] += firstTile;
+	end[2] += firstTile;
+	int level = 0;
+	while ((std::max(end[0] - begin[0], std::max(end[1] - begin[1], end[2] - begin[2])) >> level) >= 4)
+		++level;
+
+	auto& blocks = candidates.blocks;
+	blocks.clear();
+	for (int z = begin[2] >> level; z <= end[2] >> level; ++z)
+	{
+		for (int y = begin[1] >> level; y <= end[1] >> level; ++y)
+		{
+			for (int x = begin[0] >> level; x <= end[0] >> level; ++x)
+			{
+				int block[3] = { x, y, z };
+				blocks.insert(blocks.end(), block, block + 3);
+			}
+		}
+	}
+
+	for (; !blocks.empty(); --level)
+	{
+		float side = (float)(mTileSize << level) + MARGIN;
+		TriangleBoxTest test;
+		test.setup(p, low + Vector3(side, side, side));
+
+		size_t count = blocks.size() / 3;
+		for (int i = 0; i < 3; ++i)
+		{
+			candidates.pos[i].resize(count);
+			for (size_t n = 0; n < count; ++n)
+				candidates.pos[i][n] = mGrid.offset[i] + (blocks[n * 3 + i] << level) * mTileSize;
+		}
+		candidates.hits.resize(count);
+		if (mOverlap(test, candidates.pos[0].data(), candidates.pos[1].data(), candidates.pos[2].data(), count, candidates.hits.data()) == 0)
+			return;
+
+		if (level == 0)
+		{
+			for (size_t n = 0; n < count; ++n)
+			{
+				const int* t = blocks.data() + n * 3;
+				if (candidates.hits[n])
+					out.push_back(t[0] + (t[1] + (size_t)(t[2] - firstTile) * tiles[1]) * tiles[0]);
+			}
+			return;
+		}
+
+		//the children of the blocks hit that are inside the bound
+		auto& children = candidates.children;
+		children.clear();
+		for (size_t n = 0; n < count; ++n)
+		{
+			if (!candidates.hits[n])
+				continue;
+			for (int c = 0; c < 8; ++c)
+			{
+				int child[3];
+				bool inside = true;
+				for (int i = 0; i < 3; ++i)
+				{
+					child[i] = blocks[n * 3 + i] * 2 + ((c >> i) & 1);
+					inside &= child[i] >= begin[i] >> (level - 1) && child[i] <= end[i] >> (level - 1);
+				}
+				if (inside)
+					children.insert(children.end(), child, child + 3);
+			}
+		}
+		blocks.swap(children);
+	}
+}
+
+void CpuVoxelizer::fetch(const Source& src, size_t triangle, Vertex* tri)const
+{
+	const VoxelResource* res = src.res;
+	for (size_t i = 0; i < 3; ++i)
+	{
+		size_t index = triangle * 3 + i;
+		if (res->mCompactIndices.getCount())
+			index = res->mCompactIndices.get(index);
+		else if (!res->mIndexData.empty())
+		{
+			const char* data = res->mIndexData.data();
+			if (res->mIndexStride == 2)
+				index = ((const unsigned short*)data)[index];
+			else
+				index = ((const unsigned int*)data)[index];
+		}
+
+		const char* vertex = res->mVertices + index * res->mVertexStride;
+		Vertex& v = tri[i];
+		VertexDecoder::decode(*src.pos, vertex, &v.pos.x);
+
+		if (src.color)
+			VertexDecoder::decode(*src.color, vertex, v.color);
+		else
+		{
+			for (int c = 0; c < 4; ++c)
+				v.color[c] = 1.0f;
+		}
+
+		if (src.uv)
+			VertexDecoder::decode(*src.uv, vertex, v.uv);
+		else
+			v.uv[0] = v.uv[1] = 0;
+	}
+}
+
+void CpuVoxelizer::setup(Triangle& tri, const Grid& grid)const
+{
+	AABB bound;
+	for (int i = 0; i < 3; ++i)
+	{
+		Vertex& v = tri.vertices[i];
+		v.pos = (v.pos - grid.origin) * grid.scale;
+		bound.merge(v.pos);
+	}
+
+	//a little wider than the bound, interpolated depth may round past it.
+	//parity marks the voxel after the crossing, up to half a voxel past the bound in x
+	//a center sample stands for 1 / cos of the plane against the projection,
+	//tiny triangles for no more than themselves
+	Vector3 normal = (tri.vertices[1].pos - tri.vertices[0].pos).crossProduct(tri.vertices[2].pos - tri.vertices[1].pos);
+	float length = sqrt(normal.dotProduct(normal));
+	float dominant = std::max(fabs(normal.x), std::max(fabs(normal.y), fabs(normal.z)));
+	float weight = dominant > 0 ? std::min(length * 0.5f, length / dominant) : 0;
+	tri.weight = (unsigned short)std::min(std::max(1u, (unsigned int)(weight * Deduplicator::WEIGHT_ONE)), 0xffffu);
+	tri.area = dominant * 0.5f;
+
+	//level 0 texels under one fragment pick the mip, so coarse grids don't read the full image
+	tri.mip = 0;
+	if (tri.texture && dominant > 0)
+	{
+		const Vertex* v = tri.vertices;
+		const MipTexture::Level& level = tri.texture->getLevel(0);
+		float uvArea = fabs((v[1].uv[0] - v[0].uv[0]) * (v[2].uv[1] - v[0].uv[1]) - (v[1].uv[1] - v[0].uv[1]) * (v[2].uv[0] - v[0].uv[0]));
+		tri.mip = (unsigned short)tri.texture->selectLevel(uvArea * level.width * level.height / dominant);
+	}
+
+	//conservative modes also take the voxels that end right at the bound
+	const float EPSILON = 1.0f / 1024;
+	for (int i = 0; i < 3; ++i)
+	{
+		float margin = (i == 0 && mFillMode == Voxelizer::FM_SOLID_PARITY) ? 0.5f + EPSILON : EPSILON;
+		float lowMargin = mRasterMode == Voxelizer::RM_CENTER ? EPSILON : 1.0f;
+		int low = clamp((int)floor(bound.getMin()[i] - lowMargin) - grid.offset[i], 0, grid.size[i] - 1);
+		int high = clamp((int)floor(bound.getMax()[i] + margin) - grid.offset[i], 0, grid.size[i] - 1);
+		tri.tileMin[i] = low / mTileSize;
+		tri.tileMax[i] = high / mTileSize;
+	}
+}
+
+void CpuVoxelizer::rasterize(const Triangle& triangle, const Grid& grid, const Tile& tile, AppendBuffer<Fragment>& out)const
+{
+	const Vertex* tri = triangle.vertices;
+	Vector3 p[3] = { tri[0].pos, tri[1].pos, tri[2].pos };
+
+	//project along the dominant axis like gs does
+	Vector3 normal = (p[1] - p[0]).crossProduct(p[2] - p[1]);
+	float X = fabs(normal.x);
+	float Y = fabs(normal.y);
+	float Z = fabs(normal.z);
+	int axis = (X > Y && X > Z) ? 0 : ((Y > X && Y > Z) ? 1 : 2);
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+
+	const int* offset = grid.offset;
+	Fragment fragment;
+	fragment.weight = triangle.weight;
+	fragment.material = triangle.material;
+	scan(p, u, v, tile.min[u] + offset[u], tile.max[u] - 1 + offset[u], tile.min[v] + offset[v], tile.max[v] - 1 + offset[v], [&](int i, int j, const float* l)
+	{
+		float depth = l[0] * p[0][axis] + l[1] * p[1][axis] + l[2] * p[2][axis];
+		//clamped into the whole grid, a slab only keeps its own part
+		int pos[3];
+		pos[axis] = clamp((int)floor(depth), mGrid.offset[axis], mGrid.offset[axis] + mGrid.size[axis] - 1) - offset[axis];
+		if (pos[axis] < tile.min[axis] || pos[axis] >= tile.max[axis])
+			return;
+
+		pos[u] = i - offset[u];
+		pos[v] = j - offset[v];
+		fragment.key = VoxelKey::make(pos);
+		fragment.color = shade(triangle, l);
+		out.push_back(fragment);
+	});
+}
+
+void CpuVoxelizer::rasterizeConservative(const Triangle& triangle, const Grid& grid, const Tile& tile, Candidates& candidates, AppendBuffer<Fragment>& out)const
+{
+	const Vertex* tri = triangle.vertices;
+	Vector3 p[3] = { tri[0].pos, tri[1].pos, tri[2].pos };
+
+	Vector3 normal = (p[1] - p[0]).crossProduct(p[2] - p[1]);
+	float X = fabs(normal.x);
+	float Y = fabs(normal.y);
+	float Z = fabs(normal.z);
+	int axis = (X > Y && X > Z) ? 0 : ((Y > X && Y > Z) ? 1 : 2);
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+	if (normal[axis] == 0)
+		return;
+
+	const int* offset = grid.offset;
+	for (int i = 0; i < 3; ++i)
+		candidates.pos[i].clear();
+
+	//a triangle strictly inside one voxel only touches that one, splat it without the test
+	bool splat = mRasterMode == Voxelizer::RM_26_SEPARATING;
+	int cell[3];
+	for (int i = 0; i < 3 && splat; ++i)
+	{
+		float low = std::min(p[0][i], std::min(p[1][i], p[2][i]));
+		float high = std::max(p[0][i], std::max(p[1][i], p[2][i]));
+		cell[i] = (int)floor(low);
+		splat = low > cell[i] && high < cell[i] + 1;
+	}
+
+	size_t count = 0;
+	if (splat)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (cell[i] < tile.min[i] + offset[i] || cell[i] >= tile.max[i] + offset[i])
+				return;
+			candidates.pos[i].push_back(cell[i]);
+		}
+		count = 1;
+		candidates.hits.assign(1, 1);
+	}
+	else
+	{
+		TriangleBoxTest test;
+		test.setup(p, Vector3(1, 1, 1), mRasterMode == Voxelizer::RM_6_SEPARATING);
+
+		int begin[3], end[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			begin[i] = std::max((int)ceil(test.lo[i]), tile.min[i] + offset[i]);
+			end[i] = std::min((int)floor(test.hi[i]), tile.max[i] - 1 + offset[i]);
+			if (begin[i] > end[i])
+				return;
+		}
+
+		//each column only needs the few boxes around the plane, the kernel decides
+		float invNormal = 1.0f / normal[axis];
+		for (int j = begin[v]; j <= end[v]; ++j)
+		{
+			for (int i = begin[u]; i <= end[u]; ++i)
+			{
+				float rest = normal[u] * i + normal[v] * j;
+				float a = (test.planeMin - rest) * invNormal;
+				float b = (test.planeMax - rest) * invNormal;
+				int low = std::max((int)floor(std::min(a, b)) - 1, begin[axis]);
+				int high = std::min((int)ceil(std::max(a, b)) + 1, end[axis]);
+				for (int w = low; w <= high; ++w)
+				{
+					candidates.pos[axis].push_back(w);
+					candidates.pos[u].push_back(i);
+					candidates.pos[v].push_back(j);
+				}
+			}
+		}
+
+		count = candidates.pos[0].size();
+		candidates.hits.resize(count);
+		if (count == 0 || mOverlap(test, candidates.pos[0].data(), candidates.pos[1].data(), candidates.pos[2].data(), count, candidates.hits.data()) == 0)
+			return;
+	}
+
+	//barycentric of the voxel center on the dominant projection, clamped into the triangle
+	float du1 = p[1][u] - p[0][u], dv1 = p[1][v] - p[0][v];
+	float du2 = p[2][u] - p[0][u], dv2 = p[2][v] - p[0][v];
+	float invArea = 1.0f / (du1 * dv2 - dv1 * du2);
+	Fragment fragment;
+	fragment.weight = triangle.weight;
+	fragment.material = triangle.material;
+	for (size_t n = 0; n < count; ++n)
+	{
+		if (!candidates.hits[n])
+			continue;
+
+		int pos[3];
+		for (int i = 0; i < 3; ++i)
+			pos[i] = candidates.pos[i][n];
+
+		float cu = pos[u] + 0.5f - p[0][u];
+		float cv = pos[v] + 0.5f - p[0][v];
+		for (int i = 0; i < 3; ++i)
+			pos[i] -= offset[i];
+		float l[3];
+		l[1] = std::max((cu * dv2 - cv * du2) * invArea, 0.0f);
+		l[2] = std::max((du1 * cv - dv1 * cu) * invArea, 0.0f);
+		l[0] = std::max(1.0f - l[1] - l[2], 0.0f);
+		float sum = l[0] + l[1] + l[2];
+		for (int i = 0; i < 3; ++i)
+			l[i] /= sum;
+
+		fragment.key = VoxelKey::make(pos);
+		fragment.color = shade(triangle, l);
+		out.push_back(fragment);
+	}
+}
+
+void CpuVoxelizer::markParity(const Triangle& triangle, const Grid& grid, const Tile& tile)
+{
+	const Vertex* tri = triangle.vertices;
+	Vector3 p[3] = { tri[0].pos, tri[1].pos, tri[2].pos };
+
+	//every x column whose center passes the triangle flips the first voxel
+	//behind the crossing, a running xor along x then leaves the inside set
+	const int* offset = grid.offset;
+	scan(p, 1, 2, tile.min[1] + offset[1], tile.max[1] - 1 + offset[1], tile.min[2] + offset[2], tile.max[2] - 1 + offset[2], [&](int y, int z, const float* l)
+	{
+		float x = l[0] * p[0].x + l[1] * p[1].x + l[2] * p[2].x;
+		int first = std::max((int)ceil(x - 0.5f) - offset[0], 0);
+		if (first >= tile.min[0] && first < tile.max[0] && first < grid.size[0])
+			mSolid.flip(first, y - offset[1], z - offset[2]);
+	});
+}
+
+void CpuVoxelizer::markWalls(const Triangle& triangle, const Grid& grid, const Tile& tile)
+{
+	const Vertex* tri = triangle.vertices;
+	Vector3 p[3] = { tri[0].pos, tri[1].pos, tri[2].pos };
+
+	//the dominant projection alone leaves gaps a 6-connected flood slips through.
+	//marking the crossing of every center line along all 3 axes closes them
+	const int* offset = grid.offset;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		scan(p, u, v, tile.min[u] + offset[u], tile.max[u] - 1 + offset[u], tile.min[v] + offset[v], tile.max[v] - 1 + offset[v], [&](int i, int j, const float* l)
+		{
+			float depth = l[0] * p[0][axis] + l[1] * p[1][axis] + l[2] * p[2][axis];
+			int pos[3];
+			pos[axis] = clamp((int)floor(depth), mGrid.offset[axis], mGrid.offset[axis] + mGrid.size[axis] - 1) - offset[axis];
+			if (pos[axis] < tile.min[axis] || pos[axis] >= tile.max[axis])
+				return;
+
+			pos[u] = i - offset[u];
+			pos[v] = j - offset[v];
+			mSurface.set(pos[0], pos[1], pos[2]);
+		});
+	}
+}
+
+void CpuVoxelizer::fill()
+{
+	typedef BitGrid::Word Word;
+	size_t rowWords = mSolid.getRowWords();
+	size_t rows = mSolid.getRowCount();
+	Word tail = mSolid.getTailMask();
+	std::vector<FragmentSpan> surface;
+	getSpans(surface);
+
+	if (mFillMode == Voxelizer::FM_SOLID_PARITY)
+	{
+		sweepParity();
+
+		//surface voxels are already out
+		mPool.parallelFor(surface.size(), 1, [&](size_t begin, size_t end, size_t thread)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				int pos[3];
+				for (const Fragment* f = surface[i].data; f != surface[i].data + surface[i].size; ++f)
+				{
+					f->key.getPos(pos);
+					mSolid.reset(pos[0], pos[1], pos[2]);
+				}
+			}
+		});
+	}
+	else
+	{
+		floodExterior();
+
+		//whatever the outside didn't reach, walls included, minus the surface voxels already out
+		mPool.parallelFor(surface.size(), 1, [&](size_t begin, size_t end, size_t thread)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				int pos[3];
+				for (const Fragment* f = surface[i].data; f != surface[i].data + surface[i].size; ++f)
+				{
+					f->key.getPos(pos);
+					mSolid.set(pos[0], pos[1], pos[2]);
+				}
+			}
+		});
+		mPool.parallelFor(rows * rowWords, ROW_GRAIN, [&](size_t begin, size_t end, size_t thread)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				Word x = ~mSolid.load(i);
+				mSolid.store(i, (i + 1) % rowWords ? x : x & tail);
+			}
+		});
+	}
+
+	int height = mSolid.getSize(1);
+	mPool.parallelFor(rows, ROW_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		auto& out = mFragments[thread];
+		Fragment fragment;
+		fragment.color = 0xffffffff;
+		fragment.weight = Deduplicator::WEIGHT_ONE;
+		fragment.material = 0;
+
+		for (size_t r = begin; r < end; ++r)
+		{
+			int y = (int)(r % height);
+			int z = (int)(r / height);
+			size_t first = r * rowWords;
+			for (size_t w = 0; w < rowWords; ++w)
+			{
+				for (Word x = mSolid.load(first + w); x; x &= x - 1)
+				{
+					fragment.key = VoxelKey::make((int)(w * BitGrid::WORD_BITS) + BitGrid::countTrailingZeros(x), y, z);
+					out.push_back(fragment);
+				}
+			}
+		}
+	});
+}
+
+void CpuVoxelizer::sweepParity()
+{
+	typedef BitGrid::Word Word;
+	size_t rowWords = mSolid.getRowWords();
+	Word tail = mSolid.getTailMask();
+
+	//running parity of the crossings, a prefix xor inside each word carried across the row
+	mPool.parallelFor(mSolid.getRowCount(), ROW_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		for (size_t r = begin; r < end; ++r)
+		{
+			size_t first = r * rowWords;
+			Word carry = 0;
+			for (size_t w = 0; w < rowWords; ++w)
+			{
+				Word x = mSolid.load(first + w);
+				x ^= x << 1;
+				x ^= x << 2;
+				x ^= x << 4;
+				x ^= x << 8;
+				x ^= x << 16;
+				x ^= x << 32;
+				x ^= carry;
+				carry = (Word)0 - (x >> (BitGrid::WORD_BITS - 1));
+				mSolid.store(first + w, w + 1 == rowWords ? x & tail : x);
+			}
+		}
+	});
+}
+
+void CpuVoxelizer::floodExterior()
+{
+	typedef BitGrid::Word Word;
+	const int TOP = BitGrid::WORD_BITS - 1;
+	size_t rowWords = mSolid.getRowWords();
+	size_t rows = mSolid.getRowCount();
+	size_t words = mSolid.getWordCount();
+	int width = mSolid.getSize(0);
+	int height = mSolid.getSize(1);
+	int depth = mSolid.getSize(2);
+	Word tail = mSolid.getTailMask();
+	size_t threads = mPool.getThreadCount();
+
+	//words are the unit of work. a word only grows by whole runs of open bits, so it grows
+	//at most 32 times and is queued at most a few times for each, linear in the grid.
+	//words only gain bits (fetchOr), whoever gains them passes them on
+	auto getOpen = [&](size_t word)
+	{
+		Word open = ~mSurface.load(word);
+		return word % rowWords + 1 == rowWords ? open & tail : open;
+	};
+	auto getNeighbors = [&](size_t word, size_t* neighbors)
+	{
+		size_t row = word / rowWords;
+		int y = (int)(row % height);
+		int z = (int)(row / height);
+		int count = 0;
+		if (y > 0) neighbors[count++] = word - rowWords;
+		if (y + 1 < height) neighbors[count++] = word + rowWords;
+		if (z > 0) neighbors[count++] = word - rowWords * height;
+		if (z + 1 < depth) neighbors[count++] = word + rowWords * height;
+		return count;
+	};
+	//seeds of word from its neighbors. the grid border is outside, as if there was one more
+	//empty layer around it
+	auto getReach = [&](size_t word)
+	{
+		size_t neighbors[4];
+		int count = getNeighbors(word, neighbors);
+		Word reach = count < 4 ? ~(Word)0 : 0;
+		for (int n = 0; n < count; ++n)
+			reach |= mSolid.load(neighbors[n]);
+
+		size_t w = word % rowWords;
+		if (w == 0)
+			reach |= 1;
+		else
+			reach |= mSolid.load(word - 1) >> TOP;
+		if (w + 1 == rowWords)
+			reach |= (Word)1 << ((width - 1) % BitGrid::WORD_BITS);
+		else
+			reach |= mSolid.load(word + 1) << TOP;
+		return reach;
+	};
+	//the runs of open bits holding a seed, returns the bits word gained
+	auto grow = [&](size_t word, Word reach)
+	{
+		Word open = getOpen(word);
+		Word old = mSolid.load(word);
+		Word x = old | (open & reach);
+		Word g = open;
+		x |= g & (x << 1); g &= g << 1;
+		x |= g & (x << 2); g &= g << 2;
+		x |= g & (x << 4); g &= g << 4;
+		x |= g & (x << 8); g &= g << 8;
+		x |= g & (x << 16); g &= g << 16;
+		x |= g & (x << 32);
+		g = open;
+		x |= g & (x >> 1); g &= g >> 1;
+		x |= g & (x >> 2); g &= g >> 2;
+		x |= g & (x >> 4); g &= g >> 4;
+		x |= g & (x >> 8); g &= g >> 8;
+		x |= g & (x >> 16); g &= g >> 16;
+		x |= g & (x >> 32);
+		return x == old ? 0 : x & ~mSolid.fetchOr(word, x);
+	};
+
+	//a word is queued once per round, the stamp is the round it was queued in
+	std::unique_ptr<std::atomic<unsigned int>[]> stamps(new std::atomic<unsigned int>[words]);
+	for (size_t i = 0; i < words; ++i)
+		stamps[i].store(0, std::memory_order_relaxed);
+
+	std::vector<std::vector<size_t>> next(threads);
+	std::vector<size_t> frontier;
+	for (size_t r = 0; r < rows; ++r)
+	{
+		int y = (int)(r % height);
+		int z = (int)(r / height);
+		bool border = y == 0 || y + 1 == height || z == 0 || z + 1 == depth;
+		for (size_t w = 0; w < rowWords; ++w)
+		{
+			if (border || w == 0 || w + 1 == rowWords)
+				frontier.push_back(r * rowWords + w);
+		}
+	}
+
+	for (unsigned int round = 1; !frontier.empty(); ++round)
+	{
+		mPool.parallelFor(frontier.size(), WORD_GRAIN, [&](size_t begin, size_t end, size_t thread)
+		{
+			std::vector<size_t>& queue = next[thread];
+			auto pass = [&](size_t word, Word gained)
+			{
+				size_t neighbors[4];
+				int count = getNeighbors(word, neighbors);
+				for (int n = 0; n < count; ++n)
+				{
+					size_t i = neighbors[n];
+					if ((gained & getOpen(i) & ~mSolid.load(i)) && stamps[i].exchange(round, std::memory_order_relaxed) != round)
+						queue.push_back(i);
+				}
+			};
+
+			for (size_t f = begin; f < end; ++f)
+			{
+				size_t word = frontier[f];
+				Word gained = grow(word, getReach(word));
+				if (!gained)
+					continue;
+				pass(word, gained);
+
+				//a run reaching the end of the word goes on in the next one of the row right away
+				size_t w = word % rowWords;
+				Word edge = gained;
+				for (size_t i = word, x = w; (edge >> TOP) && x + 1 < rowWords; )
+				{
+					edge = grow(++i, 1);
+					++x;
+					if (edge)
+						pass(i, edge);
+				}
+				edge = gained;
+				for (size_t i = word, x = w; (edge & 1) && x > 0; )
+				{
+					edge = grow(--i, (Word)1 << TOP);
+					--x;
+					if (edge)
+						pass(i, edge);
+				}
+			}
+		});
+
+		frontier.clear();
+		for (auto& n : next)
+		{
+			frontier.insert(frontier.end(), n.begin(), n.end());
+			n.clear();
+		}
+	}
+}
+
+unsigned int CpuVoxelizer::shade(const Triangle& triangle, const float* l)const
+{
+	const Vertex* tri = triangle.vertices;
+	float color[4];
+	for (int c = 0; c < 4; ++c)
+		color[c] = l[0] * tri[0].color[c] + l[1] * tri[1].color[c] + l[2] * tri[2].color[c];
+
+	if (triangle.texture)
+	{
+		float texel[4];
+		triangle.texture->sample(triangle.mip,
+			l[0] * tri[0].uv[0] + l[1] * tri[1].uv[0] + l[2] * tri[2].uv[0],
+			l[0] * tri[0].uv[1] + l[1] * tri[1].uv[1] + l[2] * tri[2].uv[1],
+			texel);
+		for (int c = 0; c < 4; ++c)
+			color[c] *= texel[c];
+	}
+
+	//D3DCOLORtoUBYTE4, the components are already in bgra order
+	unsigned int packed = 0;
+	for (int c = 0; c < 4; ++c)
+		packed |= (unsigned int)(std::min(std::max(color[c], 0.0f), 1.0f) * 255.001953f) << (c * 8);
+	return packed;
+}
@@ -0,0 +1,186 @@
+#ifndef _AHDCpuVoxelizer_H_
+#define _AHDCpuVoxelizer_H_
+
+#include "AHD.h"
+#include "AHDUtils.h"
+#include "AHDThreadPool.h"
+#include "AHDBitGrid.h"
+#include "AHDOverlap.h"
+#include "AHDAppendBuffer.h"
+#include "AHDDedup.h"
+#include "AHDTexture.h"
+#include <vector>
+#include <string>
+#include <map>
+
+namespace AHD
+{
+	//software version of DefaultEffect.hlsl, every triangle is projected along the
+	//dominant axis of its normal and rasterized at pixel centers, one voxel per fragment.
+	//triangles are binned into the cubic tiles of the grid they overlap first and the tiles are
+	//rasterized independently, so one huge resource still spreads over all threads.
+	class CpuVoxelizer
+	{
+	public:
+		struct Grid
+		{
+			Vector3 origin;//min corner of voxel (0, 0, 0) in world space
+			Vector3 scale;//voxels per world unit, per axis
+			//voxel the grid starts at. triangles stay in voxels from origin and are only shifted
+			//when binned and written, so the same triangle rasterizes alike in any grid
+			int offset[3];
+			int size[3];
+		};
+
+	public:
+		void addTexture(const std::string& name, size_t width, size_t height, const void* data);
+		bool hasTexture(const std::string& name)const;
+
+		void setTileSize(int size);
+		const std::vector<TileStat>& getTileStats()const{ return mTileStats; }
+		void setFillMode(Voxelizer::FillMode mode){ mFillMode = mode; }
+		void setRasterMode(Voxelizer::RasterMode mode){ mRasterMode = mode; }
+
+		CpuVoxelizer(ThreadPool& pool);
+
+		//the triangles are set up once and bucketed by z slabs of slabSize voxels rounded up
+		//to whole tiles, then voxelizeSlab rasterizes one slab at a time. its keys start at
+		//z = 0, which is getSlabOffset voxels into the grid. a slab of the grid size is all of it
+		void load(const Grid& grid, size_t count, VoxelResource** res, int slabSize);
+		size_t getSlabCount()const{ return mSlabOffsets.empty() ? 0 : mSlabOffsets.size() - 1; }
+		int getSlabOffset(size_t slab)const{ return (int)slab * mSlabSize; }
+		//fragments stay in the per thread buffers until the next call
+		void voxelizeSlab(size_t slab);
+		//returns the fragment count
+		size_t getSpans(std::vector<FragmentSpan>& spans)const;
+
+	private:
+		struct Vertex
+		{
+			Vector3 pos;
+			float color[4];//bgra
+			float uv[2];
+		};
+
+		struct Source
+		{
+			VoxelResource* res;
+			const MipTexture* texture;
+			//attributes of res->mVertices, nullptr when it has none
+			const VertexDesc* pos;
+			const VertexDesc* color;
+			const VertexDesc* uv;
+			size_t first;//index of its first triangle in the whole batch
+			size_t triangles;//of the resource, there are this many per world
+			unsigned short material;
+			std::vector<Matrix4> worlds;//none is the resource as it is
+		};
+
+		//in voxels from the grid origin
+		struct Triangle
+		{
+			Vertex vertices[3];
+			const MipTexture* texture;
+			unsigned short weight;//surface area of one fragment, for RP_COVERAGE
+			unsigned short material;
+			unsigned short mip;//level of texture, by the texels one fragment covers
+			float area;//of the projection along the dominant axis, in voxels
+			int tileMin[3];
+			int tileMax[3];
+		};
+
+		struct Tile
+		{
+			int min[3];
+			int max[3];//exclusive
+		};
+
+		//triangles [first, last) of mBins in one tile, a crowded tile is cut into several
+		struct Task
+		{
+			unsigned int tile;
+			unsigned int first;
+			unsigned int last;
+			float cost;
+		};
+
+		//the fragments of one instance, reused by the instances whole voxels away from it
+		struct Stamp
+		{
+			int offset[3];//voxel of the first cell, from the grid origin
+			int size[3];
+			std::vector<Fragment> fragments;//keys from offset
+		};
+
+		struct Copy
+		{
+			size_t stamp;
+			int shift[3];//in voxels from the instance the stamp was rasterized from
+		};
+
+		//boxes waiting for the overlap kernel, one per thread
+		struct Candidates
+		{
+			std::vector<int> pos[3];
+			std::vector<unsigned char> hits;
+			//blocks of tiles as x, y, z triples, see overlapTiles
+			std::vector<int> blocks;
+			std::vector<int> children;
+		};
+
+		//the instances of a resource into sources to rasterize and masters of new stamps
+		void instance(const Source& src, const std::vector<Matrix4>& instances, std::vector<Source>& sources, std::vector<Source>& masters);
+		//sets the first triangle of every source, triangles are fetched once for all its worlds
+		void setupSources(std::vector<Source>& sources, const Grid& grid, std::vector<Triangle>& triangles);
+		//the fragments of mStamps[i] from the triangles of masters[i]
+		void rasterizeStamps(const std::vector<Source>& masters, const std::vector<Triangle>& triangles);
+		void fetch(const Source& src, size_t triangle, Vertex* tri)const;
+		void setup(Triangle& tri, const Grid& grid)const;
+		//mTriangles[*first..*last) into the tiles of a slab starting at tile firstTile along z
+		void bin(const unsigned int* first, const unsigned int* last, const int* tiles, int firstTile);
+		//indices of the tiles of the slab the triangle overlaps
+		void overlapTiles(const Triangle& tri, const int* tiles, int firstTile, Candidates& candidates, std::vector<size_t>& out)const;
+		void rasterize(const Triangle& tri, const Grid& grid, const Tile& tile, AppendBuffer<Fragment>& out)const;
+		//every voxel accepted by the overlap test, color from the nearest point of the triangle
+		void rasterizeConservative(const Triangle& tri, const Grid& grid, const Tile& tile, Candidates& candidates, AppendBuffer<Fragment>& out)const;
+		//flips the first voxel center behind the triangle in every x column it crosses
+		void markParity(const Triangle& tri, const Grid& grid, const Tile& tile);
+		//closed walls for the exterior flood
+		void markWalls(const Triangle& tri, const Grid& grid, const Tile& tile);
+		//appends the inside voxels of the solid modes behind the surface fragments
+		void fill();
+		//xor sweep along x, leaves the voxels between odd and even crossings
+		void sweepParity();
+		//mSolid becomes everything reachable from the grid border without crossing the walls in mSurface
+		void floodExterior();
+		//interpolated color at barycentric l, times the texture, packed bgra8
+		unsigned int shade(const Triangle& tri, const float* l)const;
+
+	private:
+		ThreadPool& mPool;
+		std::map<std::string, MipTexture> mTextures;
+
+		int mTileSize = 32;
+		Voxelizer::FillMode mFillMode = Voxelizer::FM_SURFACE;
+		Voxelizer::RasterMode mRasterMode = Voxelizer::RM_CENTER;
+		OverlapKernel mOverlap = nullptr;
+		Grid mGrid;
+		std::vector<Triangle> mTriangles;
+		//triangles of slab i are mSlabs[mSlabOffsets[i], mSlabOffsets[i + 1])
+		int mSlabSize = 0;
+		std::vector<unsigned int> mSlabOffsets;
+		std::vector<unsigned int> mSlabs;
+		std::vector<Stamp> mStamps;
+		std::vector<Copy> mCopies;
+		BitGrid mSolid;
+		BitGrid mSurface;
+		//triangles of tile i are mBins[mBinOffsets[i], mBinOffsets[i + 1])
+		std::vector<unsigned int> mBinOffsets;
+		std::vector<unsigned int> mBins;
+		std::vector<TileStat> mTileStats;
+		//one per thread, kept across calls
+		std::vector<AppendBuffer<Fragment>> mFragments;
+	};
+}
+
+#endif
@@ -0,0 +1,340 @@
+#include "AHDDedup.h"
+#include "AHDMorton.h"
+#include <algorithm>
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	const int DIGIT_BITS = 8;
+	const size_t DIGITS = 1 << DIGIT_BITS;
+	const size_t CONVERT_GRAIN = 4096;
+	const size_t SPAN_SIZE = 4096;
+
+	//contiguous share of [0, count) for one thread
+	inline size_t blockBegin(size_t count, size_t block, size_t blocks)
+	{
+		return (size_t)((unsigned long long)count * block / blocks);
+	}
+
+	inline VoxelKey moveKey(const VoxelKey& key, const int* offset)
+	{
+		int pos[3];
+		key.getPos(pos);
+		return VoxelKey::make(pos[0] + offset[0], pos[1] + offset[1], pos[2] + offset[2]);
+	}
+}
+
+unsigned int Deduplicator::pack(const int* color)
+{
+	return color[0] | (color[1] << 8) | (color[2] << 16) | ((unsigned int)color[3] << 24);
+}
+
+void Deduplicator::unpack(unsigned int packed, int* color)
+{
+	for (int c = 0; c < 4; ++c)
+		color[c] = (packed >> (c * 8)) & 0xff;
+}
+
+void Deduplicator::run(ThreadPool& pool, const std::vector<FragmentSpan>& spans, const int* offset)
+{
+	bool moved = offset[0] != 0 || offset[1] != 0 || offset[2] != 0;
+	size_t count = 0;
+	for (auto& i : spans)
+		count = std::max(count, i.offset + i.size);
+
+	mFragments.resize(count);
+	std::vector<unsigned long long> ones(pool.getThreadCount(), 0);
+	std::vector<unsigned long long> zeros(pool.getThreadCount(), 0);
+	pool.parallelFor(spans.size(), 1, [&](size_t begin, size_t end, size_t thread)
+	{
+		unsigned long long any = 0;
+		unsigned long long all = ~0ull;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Fragment* in = spans[i].data;
+			Fragment* out = mFragments.data() + spans[i].offset;
+			for (size_t n = 0; n < spans[i].size; ++n)
+			{
+				out[n] = in[n];
+				if (moved)
+					out[n].key = moveKey(in[n].key, offset);
+				any |= out[n].key.value;
+				all &= out[n].key.value;
+			}
+		}
+		ones[thread] |= any;
+		zeros[thread] |= ~all;
+	});
+
+	//digits every key has in common don't need a pass
+	unsigned long long digits = 0;
+	for (size_t i = 0; i < ones.size(); ++i)
+		digits |= ones[i] & zeros[i];
+	resolve(pool, digits);
+}
+
+void Deduplicator::run(ThreadPool& pool, const Voxel* fragments, size_t count, bool deduplicate, const int* offset)
+{
+	auto& converted = deduplicate ? mFragments : mResolved;
+	converted.resize(count);
+	std::vector<unsigned long long> ones(pool.getThreadCount(), 0);
+	std::vector<unsigned long long> zeros(pool.getThreadCount(), 0);
+	pool.parallelFor(count, CONVERT_GRAIN, [&](size_t begin, size_t end, size_t thread)
+	{
+		unsigned long long any = 0;
+		unsigned long long all = ~0ull;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Voxel& v = fragments[i];
+			Fragment& out = converted[i];
+			out.key = VoxelKey::make(v.pos[0] + offset[0], v.pos[1] + offset[1], v.pos[2] + offset[2]);
+			out.color = pack(v.color);
+			out.weight = WEIGHT_ONE;
+			out.material = 0;
+			any |= out.key.value;
+			all &= out.key.value;
+		}
+		ones[thread] |= any;
+		zeros[thread] |= ~all;
+	});
+
+	if (!deduplicate)
+		return;
+
+	unsigned long long digits = 0;
+	for (size_t i = 0; i < ones.size(); ++i)
+		digits |= ones[i] & zeros[i];
+	resolve(pool, digits);
+}
+
+size_t Deduplicator::getSpans(std::vector<FragmentSpan>& spans)const
+{
+	for (size_t i = 0; i < mResolved.size(); i += SPAN_SIZE)
+	{
+		FragmentSpan span = { mResolved.data() + i, std::min(SPAN_SIZE, mResolved.size() - i), i };
+		spans.push_back(span);
+	}
+	return mResolved.size();
+}
+
+void Deduplicator::resolve(ThreadPool& pool, unsigned long long digits)
+{
+	size_t count = mFragments.size();
+	sort(pool, digits);
+	merge(pool, mFragments, 0, 1, mPolicy, mResolved);
+
+	mStat.fragments = count;
+	mStat.voxels = mResolved.size();
+	mStat.duplicateRatio = count ? 1.0f - (float)mResolved.size() / count : 0.0f;
+}
+
+void Deduplicator::sort(ThreadPool& pool, unsigned long long digits)
+{
+	size_t count = mFragments.size();
+	size_t threads = pool.getThreadCount();
+	mSwap.resize(count);
+	std::vector<size_t> offsets(threads * DIGITS);
+
+	//stable lsd passes, every thread counts and then scatters its own block
+	for (int shift = 0; shift < 64; shift += DIGIT_BITS)
+	{
+		if (((digits >> shift) & (DIGITS - 1)) == 0)
+			continue;
+
+		std::fill(offsets.begin(), offsets.end(), 0);
+		pool.run([&](size_t thread)
+		{
+			size_t* histogram = offsets.data() + thread * DIGITS;
+			size_t end = blockBegin(count, thread + 1, threads);
+			for (size_t i = blockBegin(count, thread, threads); i < end; ++i)
+				++histogram[(mFragments[i].key.value >> shift) & (DIGITS - 1)];
+		});
+
+		size_t sum = 0;
+		for (size_t d = 0; d < DIGITS; ++d)
+		{
+			for (size_t t = 0; t < threads; ++t)
+			{
+				size_t n = offsets[t * DIGITS + d];
+				offsets[t * DIGITS + d] = sum;
+				sum += n;
+			}
+		}
+
+		pool.run([&](size_t thread)
+		{
+			size_t* cursor = offsets.data() + thread * DIGITS;
+			size_t end = blockBegin(count, thread + 1, threads);
+			for (size_t i = blockBegin(count, thread, threads); i < end; ++i)
+				mSwap[cursor[(mFragments[i].key.value >> shift) & (DIGITS - 1)]++] = mFragments[i];
+		});
+
+		mFragments.swap(mSwap);
+	}
+}
+
+size_t Deduplicator::reduceLevel(ThreadPool& pool, Voxelizer::ResolvePolicy policy, unsigned int minChildren)
+{
+	//the 8 children of a cell are one run in morton order, its key is theirs without the low 3 bits
+	merge(pool, mResolved, 3, minChildren, policy, mSwap);
+	mResolved.swap(mSwap);
+	return mResolved.size();
+}
+
+void Deduplicator::merge(ThreadPool& pool, const std::vector<Fragment>& in, int shift, unsigned int minRun, Voxelizer::ResolvePolicy policy, std::vector<Fragment>& out)
+{
+	size_t count = in.size();
+	size_t threads = pool.getThreadCount();
+	auto same = [&in, shift](size_t a, size_t b){ return (in[a].key.value >> shift) == (in[b].key.value >> shift); };
+
+	//blocks start at the first fragment of a run so no run is split
+	std::vector<size_t> begins(threads + 1);
+	for (size_t t = 0; t < threads; ++t)
+	{
+		size_t begin = blockBegin(count, t, threads);
+		while (begin > 0 && begin < count && same(begin, begin - 1))
+			++begin;
+		begins[t] = t ? std::max(begin, begins[t - 1]) : 0;
+	}
+	begins[threads] = count;
+
+	std::vector<size_t> offsets(threads + 1, 0);
+	pool.run([&](size_t thread)
+	{
+		size_t runs = 0;
+		for (size_t i = begins[thread], end = begins[thread + 1]; i < end;)
+		{
+			size_t last = i + 1;
+			while (last != end && same(last, i))
+				++last;
+			if (last - i >= minRun)
+				++runs;
+			i = last;
+		}
+		offsets[thread + 1] = runs;
+	});
+	for (size_t t = 0; t < threads; ++t)
+		offsets[t + 1] += offsets[t];
+
+	out.resize(offsets[threads]);
+	pool.run([&](size_t thread)
+	{
+		std::vector<unsigned int> colors;
+		Fragment* result = out.data() + offsets[thread];
+		const Fragment* end = in.data() + begins[thread + 1];
+		for (const Fragment* first = in.data() + begins[thread]; first != end;)
+		{
+			const Fragment* last = first + 1;
+			while (last != end && (last->key.value >> shift) == (first->key.value >> shift))
+				++last;
+
+			if ((size_t)(last - first) >= minRun)
+			{
+				reduce(first, last, policy, colors, *result);
+				if (shift)
+					result->key = first->key.getParent();
+				++result;
+			}
+			first = last;
+		}
+	});
+}
+
+void Deduplicator::reduce(const Fragment* first, const Fragment* last, Voxelizer::ResolvePolicy policy, std::vector<unsigned int>& colors, Fragment& out)const
+{
+	out = *first;
+	if (last - first == 1)
+		return;
+
+	unsigned int weight = 0;
+	const Fragment* heaviest = first;
+	for (const Fragment* i = first; i != last; ++i)
+	{
+		weight += i->weight;
+		if (i->weight > heaviest->weight || (i->weight == heaviest->weight && i->material < heaviest->material))
+			heaviest = i;
+	}
+	out.material = heaviest->material;
+	out.weight = (unsigned short)std::min(weight, 0xffffu);
+	out.color = mix(first, last, policy, colors);
+}
+
+unsigned int Deduplicator::mix(const Fragment* first, const Fragment* last, Voxelizer::ResolvePolicy policy, std::vector<unsigned int>& colors)const
+{
+	//integer sums and total orders only, the fragment order never matters
+	switch (policy)
+	{
+	case Voxelizer::RP_COVERAGE:
+	{
+		unsigned long long sum[4] = { 0, 0, 0, 0 };
+		unsigned long long total = 0;
+		for (const Fragment* i = first; i != last; ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+				sum[c] += (unsigned long long)((i->color >> (c * 8)) & 0xff) * i->weight;
+			total += i->weight;
+		}
+		if (total == 0)
+			break;
+
+		unsigned int color = 0;
+		for (int c = 0; c < 4; ++c)
+			color |= (unsigned int)((sum[c] + total / 2) / total) << (c * 8);
+		return color;
+	}
+	case Voxelizer::RP_MAX_ALPHA:
+	{
+		unsigned int best = first->color;
+		for (const Fragment* i = first + 1; i != last; ++i)
+		{
+			unsigned int alpha = i->color >> 24;
+			unsigned int bestAlpha = best >> 24;
+			if (alpha > bestAlpha || (alpha == bestAlpha && i->color > best))
+				best = i->color;
+		}
+		return best;
+	}
+	case Voxelizer::RP_MAJORITY:
+	{
+		colors.clear();
+		for (const Fragment* i = first; i != last; ++i)
+			colors.push_back(i->color);
+		std::sort(colors.begin(), colors.end());
+
+		unsigned int best = colors[0];
+		size_t bestCount = 0;
+		for (size_t i = 0; i < colors.size();)
+		{
+			size_t j = i + 1;
+			while (j < colors.size() && colors[j] == colors[i])
+				++j;
+			if (j - i >= bestCount)
+			{
+				best = colors[i];
+				bestCount = j - i;
+			}
+			i = j;
+		}
+		return best;
+	}
+	default:
+		break;
+	}
+
+	unsigned int sum[4] = { 0, 0, 0, 0 };
+	unsigned int n = (unsigned int)(last - first);
+	for (const Fragment* i = first; i != last; ++i)
+	{
+		for (int c = 0; c < 4; ++c)
+			sum[c] += (i->color >> (c * 8)) & 0xff;
+	}
+
+	unsigned int color = 0;
+	for (int c = 0; c < 4; ++c)
+		color |= ((sum[c] + n / 2) / n) << (c * 8);
+	return color;
+}
@@ -0,0 +1,74 @@
+#ifndef _AHDDedup_H_
+#define _AHDDedup_H_
+
+#include "AHD.h"
+#include "AHDThreadPool.h"
+#include <vector>
+
+namespace AHD
+{
+	//what the cpu backend emits instead of a Voxel
+	struct Fragment
+	{
+		VoxelKey key;
+		unsigned int color;//bgra8, color[0] in the low byte
+		unsigned short weight;//covered surface in 2.14 fixed point
+		unsigned short material;
+	};
+
+	//fragments of voxelize, offset is where the first one lands in the whole list
+	struct FragmentSpan
+	{
+		const Fragment* data;
+		size_t size;
+		size_t offset;
+	};
+
+	//one voxel per cell: the fragments are radix sorted by morton key and every run of
+	//equal keys is resolved into one fragment in the same pass. keys are moved from the grid
+	//to absolute cells on the way in, so output is in the morton order of getKey() of the
+	//layouts, the material is the one of the heaviest fragment.
+	class Deduplicator
+	{
+	public:
+		static const unsigned int WEIGHT_ONE = 1 << 14;
+
+		static unsigned int pack(const int* color);
+		static void unpack(unsigned int packed, int* color);
+
+	public:
+		void setPolicy(Voxelizer::ResolvePolicy policy){ mPolicy = policy; }
+		Voxelizer::ResolvePolicy getPolicy()const{ return mPolicy; }
+
+		//offset is the cell of grid position (0, 0, 0)
+		void run(ThreadPool& pool, const std::vector<FragmentSpan>& spans, const int* offset);
+		//gpu fragments, all of the same weight. only converted when deduplicate is off
+		void run(ThreadPool& pool, const Voxel* fragments, size_t count, bool deduplicate, const int* offset);
+		//the result of the last run, returns its size
+		size_t getSpans(std::vector<FragmentSpan>& spans)const;
+		//replaces the result by the cells twice as large, each of the colors of its children by policy.
+		//cells with fewer than minChildren children are dropped, returns the new size
+		size_t reduceLevel(ThreadPool& pool, Voxelizer::ResolvePolicy policy, unsigned int minChildren);
+		const DedupStat& getStat()const{ return mStat; }
+
+	private:
+		//mFragments is filled, digits are the key bits that differ somewhere
+		void resolve(ThreadPool& pool, unsigned long long digits);
+		void sort(ThreadPool& pool, unsigned long long digits);
+		//every run of equal key >> shift in the sorted in becomes one fragment, shift is 0 or 3
+		//(the parent cell, keyed by getParent). runs shorter than minRun are dropped
+		void merge(ThreadPool& pool, const std::vector<Fragment>& in, int shift, unsigned int minRun, Voxelizer::ResolvePolicy policy, std::vector<Fragment>& out);
+		void reduce(const Fragment* first, const Fragment* last, Voxelizer::ResolvePolicy policy, std::vector<unsigned int>& colors, Fragment& out)const;
+		//the color of the policy
+		unsigned int mix(const Fragment* first, const Fragment* last, Voxelizer::ResolvePolicy policy, std::vector<unsigned int>& colors)const;
+
+	private:
+		Voxelizer::ResolvePolicy mPolicy = Voxelizer::RP_AVERAGE;
+		std::vector<Fragment> mFragments;
+		std::vector<Fragment> mSwap;
+		std::vector<Fragment> mResolved;
+		DedupStat mStat = { 0, 0, 0 };
+	};
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _AHDFileOutput_H_
+#define _AHDFileOutput_H_
+
+#include "AHD.h"
+#include <fstream>
+#include <stdexcept>
+
+namespace AHD
+{
+	//appends the raw records of every slab to a file, for grids whose voxels don't fit in memory
+	template<class Layout>
+	class VoxelFileOutput : public VoxelOutputT<Layout>
+	{
+	public:
+		VoxelFileOutput(const std::string& path)
+			:mFile(path.c_str(), std::ios::binary | std::ios::trunc)
+		{
+			if (!mFile)
+				throw std::runtime_error("fail to open " + path);
+		}
+
+		void output(Layout* voxels, size_t size)
+		{
+			if (size == 0)
+				return;
+			mFile.write((const char*)voxels, size * sizeof(Layout));
+			if (!mFile)
+				throw std::runtime_error("fail to write voxels");
+			mCount += size;
+		}
+
+		size_t getCount()const{ return mCount; }
+
+	private:
+		std::ofstream mFile;
+		size_t mCount = 0;
+	};
+}
+
+#endif
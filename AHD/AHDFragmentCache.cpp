@@ -0,0 +1,72 @@
+#include "AHDFragmentCache.h"
+#include <algorithm>
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	const size_t SPAN_SIZE = 4096;
+
+	bool operator == (const CpuVoxelizer::Grid& a, const CpuVoxelizer::Grid& b)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (a.origin[i] != b.origin[i] || a.scale[i] != b.scale[i] || a.offset[i] != b.offset[i] || a.size[i] != b.size[i])
+				return false;
+		}
+		return true;
+	}
+}
+
+void FragmentCache::setGrid(const CpuVoxelizer::Grid& grid, Voxelizer::RasterMode mode)
+{
+	if (!mFragments.empty() && grid == mGrid && mode == mRasterMode)
+		return;
+
+	clear();
+	mGrid = grid;
+	mRasterMode = mode;
+}
+
+void FragmentCache::store(const VoxelResource* res, const std::vector<FragmentSpan>& spans)
+{
+	auto& fragments = mFragments[res];
+	fragments.clear();
+	for (auto& i : spans)
+		fragments.insert(fragments.end(), i.data, i.data + i.size);
+}
+
+void FragmentCache::select(size_t count, VoxelResource** res)
+{
+	mSelected.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto fragments = mFragments.find(res[i]);
+		if (fragments != mFragments.end())
+			mSelected.push_back(&fragments->second);
+	}
+}
+
+size_t FragmentCache::getSpans(std::vector<FragmentSpan>& spans)const
+{
+	size_t offset = 0;
+	for (auto fragments : mSelected)
+	{
+		for (size_t i = 0; i < fragments->size(); i += SPAN_SIZE)
+		{
+			FragmentSpan span = { fragments->data() + i, std::min(SPAN_SIZE, fragments->size() - i), offset };
+			spans.push_back(span);
+			offset += span.size;
+		}
+	}
+	return offset;
+}
+
+void FragmentCache::clear()
+{
+	mFragments.clear();
+	mSelected.clear();
+}
@@ -0,0 +1,36 @@
+#ifndef _AHDFragmentCache_H_
+#define _AHDFragmentCache_H_
+
+#include "AHD.h"
+#include "AHDCpuVoxelizer.h"
+#include "AHDDedup.h"
+#include <vector>
+#include <map>
+
+namespace AHD
+{
+	//raw fragments of every resource voxelized so far, so the next voxelize only rasterizes
+	//the resources that changed and merges the rest as they are
+	class FragmentCache
+	{
+	public:
+		//forgets every resource when the grid or the raster mode differs from the last call
+		void setGrid(const CpuVoxelizer::Grid& grid, Voxelizer::RasterMode mode);
+		bool has(const VoxelResource* res)const{ return mFragments.find(res) != mFragments.end(); }
+		//the fragments of res are now the ones in spans
+		void store(const VoxelResource* res, const std::vector<FragmentSpan>& spans);
+		//the resources of the current voxelize
+		void select(size_t count, VoxelResource** res);
+		//fragments of the selected resources one after another, returns the count
+		size_t getSpans(std::vector<FragmentSpan>& spans)const;
+		void clear();
+
+	private:
+		CpuVoxelizer::Grid mGrid;
+		Voxelizer::RasterMode mRasterMode = Voxelizer::RM_CENTER;
+		std::map<const VoxelResource*, std::vector<Fragment>> mFragments;
+		std::vector<const std::vector<Fragment>*> mSelected;
+	};
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "AHDMorton.h"
+#include "AHDSimd.h"
+
+#ifdef AHD_BMI2
+#include <immintrin.h>
+#endif
+
+using namespace AHD;
+
+namespace
+{
+	const unsigned long long X_BITS = 0x1249249249249249ull;
+
+	struct Tables
+	{
+		unsigned int spread[256];//abc -> 00a00b00c
+		unsigned long long compact[512];//9 key bits -> x | y << 21 | z << 42
+	};
+
+	Tables build()
+	{
+		Tables tables;
+		for (unsigned int i = 0; i < 256; ++i)
+		{
+			unsigned int v = 0;
+			for (int b = 0; b < 8; ++b)
+				v |= ((i >> b) & 1) << (b * 3);
+			tables.spread[i] = v;
+		}
+		for (unsigned int i = 0; i < 512; ++i)
+		{
+			unsigned int v = 0;
+			for (int b = 0; b < 9; ++b)
+				v |= ((i >> b) & 1) << (b % 3 * 3 + b / 3);
+			tables.compact[i] = (v & 7) | ((unsigned long long)((v >> 3) & 7) << 21) | ((unsigned long long)(v >> 6) << 42);
+		}
+		return tables;
+	}
+
+	const Tables gTables = build();
+	//own detection, the features of AHDSimd.cpp may not be initialized yet
+	const bool gPdep = Simd::detect().fastPdep;
+
+	inline unsigned long long spread(unsigned int v)
+	{
+		const unsigned int* s = gTables.spread;
+		return s[v & 0xff] | ((unsigned long long)s[(v >> 8) & 0xff] << 24) | ((unsigned long long)s[(v >> 16) & 0x1f] << 48);
+	}
+
+#ifdef AHD_BMI2
+	AHD_TARGET("bmi2")
+	unsigned long long encodeBmi2(unsigned int x, unsigned int y, unsigned int z)
+	{
+		return _pdep_u64(x, X_BITS) | _pdep_u64(y, X_BITS << 1) | _pdep_u64(z, X_BITS << 2);
+	}
+
+	AHD_TARGET("bmi2")
+	void decodeBmi2(unsigned long long key, int* pos)
+	{
+		pos[0] = (int)_pext_u64(key, X_BITS);
+		pos[1] = (int)_pext_u64(key, X_BITS << 1);
+		pos[2] = (int)_pext_u64(key, X_BITS << 2);
+	}
+#endif
+}
+
+unsigned long long Morton::encode(int x, int y, int z)
+{
+#ifdef AHD_BMI2
+	if (gPdep)
+		return encodeBmi2((unsigned int)x & 0x1fffff, (unsigned int)y & 0x1fffff, (unsigned int)z & 0x1fffff);
+#endif
+	return spread((unsigned int)x) | (spread((unsigned int)y) << 1) | (spread((unsigned int)z) << 2);
+}
+
+void Morton::decode(unsigned long long key, int* pos)
+{
+#ifdef AHD_BMI2
+	if (gPdep)
+	{
+		decodeBmi2(key, pos);
+		return;
+	}
+#endif
+	unsigned long long v = 0;
+	for (int i = 0; i < 7; ++i)
+		v |= gTables.compact[(key >> (i * 9)) & 0x1ff] << (i * 3);
+	pos[0] = (int)(v & 0x1fffff);
+	pos[1] = (int)((v >> 21) & 0x1fffff);
+	pos[2] = (int)(v >> 42);
+}
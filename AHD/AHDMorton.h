@@ -0,0 +1,74 @@
+#ifndef _AHDMorton_H_
+#define _AHDMorton_H_
+
+#include <stddef.h>
+#include <functional>
+
+namespace AHD
+{
+	//z-order key of a voxel, 21 bits per axis interleaved as ..zyxzyx into 63 bits.
+	//pdep / pext where bmi2 is fast, byte tables everywhere else
+	class Morton
+	{
+	public:
+		static const int AXIS_BITS = 21;
+
+		//coordinates in [0, 2^21), higher bits are dropped
+		static unsigned long long encode(int x, int y, int z);
+		static void decode(unsigned long long key, int* pos);
+	};
+
+	//a voxel by its morton code, so ordering follows the z curve and sorting, comparing
+	//and hashing are plain integer operations. coordinates are in [MIN_POS, MAX_POS), moved
+	//by BIAS to [0, 2^21) before encoding so negative ones keep their order
+	struct VoxelKey
+	{
+		static const int BIAS = 1 << (Morton::AXIS_BITS - 1);
+		static const int MIN_POS = -BIAS;
+		static const int MAX_POS = BIAS;
+
+		unsigned long long value;
+
+		static VoxelKey make(int x, int y, int z)
+		{
+			VoxelKey key = { Morton::encode(x + BIAS, y + BIAS, z + BIAS) };
+			return key;
+		}
+		static VoxelKey make(const int* pos){ return make(pos[0], pos[1], pos[2]); }
+		void getPos(int* pos)const
+		{
+			Morton::decode(value, pos);
+			for (int i = 0; i < 3; ++i)
+				pos[i] -= BIAS;
+		}
+		//the cell twice as large holding this one, coordinates halved rounding down. the
+		//children of a cell share value >> 3
+		VoxelKey getParent()const
+		{
+			int pos[3];
+			Morton::decode(value >> 3, pos);
+			VoxelKey key = { Morton::encode(pos[0] + BIAS / 2, pos[1] + BIAS / 2, pos[2] + BIAS / 2) };
+			return key;
+		}
+
+		bool operator == (const VoxelKey& rhs)const{ return value == rhs.value; }
+		bool operator != (const VoxelKey& rhs)const{ return value != rhs.value; }
+		bool operator < (const VoxelKey& rhs)const{ return value < rhs.value; }
+	};
+}
+
+namespace std
+{
+	//neighbouring keys only differ in the low bits, a multiplicative mix spreads them over the buckets
+	template<>
+	struct hash<AHD::VoxelKey>
+	{
+		size_t operator()(const AHD::VoxelKey& key)const
+		{
+			unsigned long long h = key.value * 0x9e3779b97f4a7c15ull;
+			return (size_t)(h ^ (h >> 32));
+		}
+	};
+}
+
+#endif
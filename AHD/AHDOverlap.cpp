@@ -0,0 +1,304 @@
+//every kernel stays bit exact with the scalar one, no fused multiply add
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "AHDOverlap.h"
+#include <algorithm>
+#include <math.h>
+
+#ifdef AHD_X86
+#include <immintrin.h>
+#endif
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	//projections xy, yz, zx
+	const int PLANE_AXES[3][2] = { { 0, 1 }, { 1, 2 }, { 2, 0 } };
+
+	inline size_t writeMask(unsigned int bits, size_t lanes, unsigned char* result)
+	{
+		size_t hits = 0;
+		for (size_t k = 0; k < lanes; ++k)
+		{
+			result[k] = (bits >> k) & 1;
+			hits += result[k];
+		}
+		return hits;
+	}
+}
+
+void TriangleBoxTest::setup(const Vector3* triangle, const Vector3& boxSize, bool thin)
+{
+	AABB bound;
+	for (int i = 0; i < 3; ++i)
+		bound.merge(triangle[i]);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		lo[i] = bound.getMin()[i] - boxSize[i];
+		hi[i] = bound.getMax()[i];
+	}
+
+	Vector3 n = (triangle[1] - triangle[0]).crossProduct(triangle[2] - triangle[1]);
+	Vector3 critical(n.x > 0 ? boxSize.x : 0, n.y > 0 ? boxSize.y : 0, n.z > 0 ? boxSize.z : 0);
+	float d1 = n.dotProduct(critical - triangle[0]);
+	float d2 = n.dotProduct((boxSize - critical) - triangle[0]);
+	normal[0] = n.x;
+	normal[1] = n.y;
+	normal[2] = n.z;
+	planeMin = std::min(-d1, -d2);
+	planeMax = std::max(-d1, -d2);
+	if (thin)
+	{
+		Vector3 a(fabs(n.x), fabs(n.y), fabs(n.z));
+		int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+		float center = n.dotProduct(triangle[0]) - n.dotProduct(boxSize) * 0.5f;
+		float half = a[axis] * boxSize[axis] * 0.5f;
+		planeMin = center - half;
+		planeMax = center + half;
+	}
+
+	for (int plane = 0; plane < 3; ++plane)
+	{
+		int i = PLANE_AXES[plane][0];
+		int j = PLANE_AXES[plane][1];
+		//the projection looks down the remaining axis
+		float sign = n[3 - i - j] >= 0 ? 1.0f : -1.0f;
+		for (int k = 0; k < 3; ++k)
+		{
+			const Vector3& v = triangle[k];
+			Vector3 e = triangle[(k + 1) % 3] - v;
+
+			Edge& edge = edges[plane * 3 + k];
+			edge.a = -e[j] * sign;
+			edge.b = e[i] * sign;
+			edge.c = -(edge.a * v[i] + edge.b * v[j]);
+			if (thin)
+				edge.c += (edge.a * boxSize[i] + edge.b * boxSize[j]) * 0.5f
+					+ std::max(fabs(edge.a) * boxSize[i], fabs(edge.b) * boxSize[j]) * 0.5f;
+			else
+				edge.c += std::max(0.0f, boxSize[i] * edge.a) + std::max(0.0f, boxSize[j] * edge.b);
+		}
+	}
+}
+
+size_t Overlap::scalar(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	size_t hits = 0;
+	for (size_t n = 0; n < count; ++n)
+	{
+		float p[3] = { (float)x[n], (float)y[n], (float)z[n] };
+		bool overlap =
+			p[0] >= test.lo[0] && p[0] <= test.hi[0] &&
+			p[1] >= test.lo[1] && p[1] <= test.hi[1] &&
+			p[2] >= test.lo[2] && p[2] <= test.hi[2];
+
+		if (overlap)
+		{
+			float d = (test.normal[0] * p[0] + test.normal[1] * p[1]) + test.normal[2] * p[2];
+			overlap = d >= test.planeMin && d <= test.planeMax;
+		}
+
+		for (int e = 0; e < 9 && overlap; ++e)
+		{
+			const TriangleBoxTest::Edge& edge = test.edges[e];
+			const int* axes = PLANE_AXES[e / 3];
+			overlap = (edge.a * p[axes[0]] + edge.b * p[axes[1]]) + edge.c >= 0;
+		}
+
+		result[n] = overlap ? 1 : 0;
+		hits += result[n];
+	}
+	return hits;
+}
+
+#ifdef AHD_X86
+
+AHD_TARGET("sse4.1")
+size_t Overlap::sse4(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	const size_t LANES = 4;
+	size_t hits = 0;
+	size_t n = 0;
+	for (; n + LANES <= count; n += LANES)
+	{
+		__m128 p[3] =
+		{
+			_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(x + n))),
+			_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(y + n))),
+			_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(z + n))),
+		};
+
+		__m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int i = 0; i < 3; ++i)
+		{
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(p[i], _mm_set1_ps(test.lo[i])));
+			mask = _mm_and_ps(mask, _mm_cmple_ps(p[i], _mm_set1_ps(test.hi[i])));
+		}
+
+		__m128 d = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_set1_ps(test.normal[0]), p[0]),
+			_mm_mul_ps(_mm_set1_ps(test.normal[1]), p[1])),
+			_mm_mul_ps(_mm_set1_ps(test.normal[2]), p[2]));
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(d, _mm_set1_ps(test.planeMin)));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(d, _mm_set1_ps(test.planeMax)));
+
+		if (!_mm_testz_si128(_mm_castps_si128(mask), _mm_castps_si128(mask)))
+		{
+			for (int e = 0; e < 9; ++e)
+			{
+				const TriangleBoxTest::Edge& edge = test.edges[e];
+				const int* axes = PLANE_AXES[e / 3];
+				__m128 v = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(edge.a), p[axes[0]]),
+					_mm_mul_ps(_mm_set1_ps(edge.b), p[axes[1]])),
+					_mm_set1_ps(edge.c));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+			}
+		}
+
+		hits += writeMask(_mm_movemask_ps(mask), LANES, result + n);
+	}
+
+	return hits + scalar(test, x + n, y + n, z + n, count - n, result + n);
+}
+
+AHD_TARGET("avx2")
+size_t Overlap::avx2(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	const size_t LANES = 8;
+	size_t hits = 0;
+	size_t n = 0;
+	for (; n + LANES <= count; n += LANES)
+	{
+		__m256 p[3] =
+		{
+			_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(x + n))),
+			_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(y + n))),
+			_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(z + n))),
+		};
+
+		__m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int i = 0; i < 3; ++i)
+		{
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(p[i], _mm256_set1_ps(test.lo[i]), _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(p[i], _mm256_set1_ps(test.hi[i]), _CMP_LE_OQ));
+		}
+
+		__m256 d = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(_mm256_set1_ps(test.normal[0]), p[0]),
+			_mm256_mul_ps(_mm256_set1_ps(test.normal[1]), p[1])),
+			_mm256_mul_ps(_mm256_set1_ps(test.normal[2]), p[2]));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(d, _mm256_set1_ps(test.planeMin), _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(d, _mm256_set1_ps(test.planeMax), _CMP_LE_OQ));
+
+		if (!_mm256_testz_ps(mask, mask))
+		{
+			for (int e = 0; e < 9; ++e)
+			{
+				const TriangleBoxTest::Edge& edge = test.edges[e];
+				const int* axes = PLANE_AXES[e / 3];
+				__m256 v = _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(_mm256_set1_ps(edge.a), p[axes[0]]),
+					_mm256_mul_ps(_mm256_set1_ps(edge.b), p[axes[1]])),
+					_mm256_set1_ps(edge.c));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+		}
+
+		hits += writeMask(_mm256_movemask_ps(mask), LANES, result + n);
+	}
+
+	return hits + scalar(test, x + n, y + n, z + n, count - n, result + n);
+}
+
+#ifdef AHD_AVX512
+AHD_TARGET("avx512f")
+size_t Overlap::avx512(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	const size_t LANES = 16;
+	size_t hits = 0;
+	for (size_t n = 0; n < count; n += LANES)
+	{
+		//the tail goes through masked loads instead of a scalar loop
+		size_t lanes = std::min(LANES, count - n);
+		__mmask16 mask = (__mmask16)((1u << lanes) - 1);
+
+		__m512 p[3] =
+		{
+			_mm512_cvtepi32_ps(_mm512_maskz_loadu_epi32(mask, x + n)),
+			_mm512_cvtepi32_ps(_mm512_maskz_loadu_epi32(mask, y + n)),
+			_mm512_cvtepi32_ps(_mm512_maskz_loadu_epi32(mask, z + n)),
+		};
+
+		for (int i = 0; i < 3; ++i)
+		{
+			mask = _mm512_mask_cmp_ps_mask(mask, p[i], _mm512_set1_ps(test.lo[i]), _CMP_GE_OQ);
+			mask = _mm512_mask_cmp_ps_mask(mask, p[i], _mm512_set1_ps(test.hi[i]), _CMP_LE_OQ);
+		}
+
+		__m512 d = _mm512_add_ps(_mm512_add_ps(
+			_mm512_mul_ps(_mm512_set1_ps(test.normal[0]), p[0]),
+			_mm512_mul_ps(_mm512_set1_ps(test.normal[1]), p[1])),
+			_mm512_mul_ps(_mm512_set1_ps(test.normal[2]), p[2]));
+		mask = _mm512_mask_cmp_ps_mask(mask, d, _mm512_set1_ps(test.planeMin), _CMP_GE_OQ);
+		mask = _mm512_mask_cmp_ps_mask(mask, d, _mm512_set1_ps(test.planeMax), _CMP_LE_OQ);
+
+		for (int e = 0; e < 9 && mask; ++e)
+		{
+			const TriangleBoxTest::Edge& edge = test.edges[e];
+			const int* axes = PLANE_AXES[e / 3];
+			__m512 v = _mm512_add_ps(_mm512_add_ps(
+				_mm512_mul_ps(_mm512_set1_ps(edge.a), p[axes[0]]),
+				_mm512_mul_ps(_mm512_set1_ps(edge.b), p[axes[1]])),
+				_mm512_set1_ps(edge.c));
+			mask = _mm512_mask_cmp_ps_mask(mask, v, _mm512_setzero_ps(), _CMP_GE_OQ);
+		}
+
+		hits += writeMask(mask, lanes, result + n);
+	}
+	return hits;
+}
+#else
+size_t Overlap::avx512(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	return avx2(test, x, y, z, count, result);
+}
+#endif
+
+#else
+size_t Overlap::sse4(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	return scalar(test, x, y, z, count, result);
+}
+
+size_t Overlap::avx2(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	return scalar(test, x, y, z, count, result);
+}
+
+size_t Overlap::avx512(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result)
+{
+	return scalar(test, x, y, z, count, result);
+}
+#endif
+
+OverlapKernel Overlap::getKernel(SimdLevel level)
+{
+	level = std::min(level, Simd::getLevel());
+	switch (level)
+	{
+	case SL_AVX512: return &Overlap::avx512;
+	case SL_AVX2: return &Overlap::avx2;
+	case SL_SSE4: return &Overlap::sse4;
+	default: return &Overlap::scalar;
+	}
+}
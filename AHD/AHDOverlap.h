@@ -0,0 +1,50 @@
+#ifndef _AHDOverlap_H_
+#define _AHDOverlap_H_
+
+#include "AHDUtils.h"
+#include "AHDSimd.h"
+
+namespace AHD
+{
+	//separating axis triangle/box test in the form of Schwarz and Seidel,
+	//every axis is reduced to a linear function of the box min corner p:
+	//  lo <= p <= hi, planeMin <= normal.p <= planeMax,
+	//  edge[i].a * p[j] + edge[i].b * p[k] + edge[i].c >= 0 on the 3 projections
+	struct TriangleBoxTest
+	{
+		struct Edge
+		{
+			float a, b, c;
+		};
+
+		float lo[3];
+		float hi[3];
+		float normal[3];
+		float planeMin;
+		float planeMax;
+		//xy, yz, zx, 3 edges each
+		Edge edges[9];
+
+		//boxes of boxSize, exact overlap (26-separating when the box is a voxel).
+		//thin only takes boxes whose center line along the dominant normal axis meets the
+		//plane and whose diamonds meet the projections (6-separating)
+		void setup(const Vector3* triangle, const Vector3& boxSize, bool thin = false);
+	};
+
+	//writes 1 into result[i] when box (x[i], y[i], z[i]) overlaps, returns the number of hits
+	typedef size_t(*OverlapKernel)(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result);
+
+	class Overlap
+	{
+	public:
+		static size_t scalar(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result);
+		static size_t sse4(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result);
+		static size_t avx2(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result);
+		static size_t avx512(const TriangleBoxTest& test, const int* x, const int* y, const int* z, size_t count, unsigned char* result);
+
+		//the widest kernel at or below level that the cpu runs
+		static OverlapKernel getKernel(SimdLevel level = Simd::getLevel());
+	};
+}
+
+#endif
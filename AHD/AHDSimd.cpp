@@ -0,0 +1,108 @@
+#include "AHDSimd.h"
+
+#ifdef AHD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace AHD;
+
+namespace
+{
+#ifdef AHD_X86
+	void cpuid(int leaf, int subleaf, unsigned int* regs)
+	{
+#ifdef _MSC_VER
+		__cpuidex((int*)regs, leaf, subleaf);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	unsigned long long xgetbv()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+#endif
+
+	//at load time, function statics are not thread safe on vs2013
+	const CpuFeatures gFeatures = Simd::detect();
+}
+
+CpuFeatures Simd::detect()
+{
+	CpuFeatures features;
+#ifdef AHD_X86
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+	//"AuthenticAMD" in ebx, edx, ecx
+	bool amd = regs[1] == 0x68747541 && regs[3] == 0x69746e65 && regs[2] == 0x444d4163;
+	if (maxLeaf < 1)
+		return features;
+
+	cpuid(1, 0, regs);
+	unsigned int family = (regs[0] >> 8) & 0xf;
+	if (family == 0xf)
+		family += (regs[0] >> 20) & 0xff;
+	features.sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+
+	//xmm | ymm, then opmask | zmm0-15 | zmm16-31
+	unsigned long long xcr0 = osxsave ? xgetbv() : 0;
+	bool ymm = avx && (xcr0 & 0x6) == 0x6;
+	bool zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+	features.f16c = ymm && (regs[2] & (1 << 29)) != 0;
+
+	if (maxLeaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		features.avx2 = ymm && (regs[1] & (1 << 5)) != 0;
+		features.bmi2 = (regs[1] & (1 << 8)) != 0;
+		features.fastPdep = features.bmi2 && !(amd && family < 0x19);
+#ifdef AHD_AVX512
+		features.avx512 = zmm && (regs[1] & (1 << 16)) != 0;
+#endif
+	}
+#endif
+	return features;
+}
+
+const CpuFeatures& Simd::getFeatures()
+{
+	return gFeatures;
+}
+
+SimdLevel Simd::getLevel()
+{
+	const CpuFeatures& features = getFeatures();
+	if (features.avx512)
+		return SL_AVX512;
+	if (features.avx2)
+		return SL_AVX2;
+	if (features.sse41)
+		return SL_SSE4;
+	return SL_SCALAR;
+}
+
+const char* Simd::getName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SL_SCALAR: return "scalar";
+	case SL_SSE4: return "sse4";
+	case SL_AVX2: return "avx2";
+	case SL_AVX512: return "avx512";
+	default: return "unknown";
+	}
+}
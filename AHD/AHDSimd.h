@@ -0,0 +1,58 @@
+#ifndef _AHDSimd_H_
+#define _AHDSimd_H_
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define AHD_X86
+#endif
+
+//lets gcc/clang emit instructions above the compile flags in one function, msvc always can
+#if defined(AHD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define AHD_TARGET(x) __attribute__((target(x)))
+#else
+#define AHD_TARGET(x)
+#endif
+
+#if defined(AHD_X86) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define AHD_AVX512
+#endif
+
+//pdep and pext on 64 bit operands only exist in 64 bit mode
+#if defined(_M_X64) || defined(__x86_64__)
+#define AHD_BMI2
+#endif
+
+namespace AHD
+{
+	enum SimdLevel
+	{
+		SL_SCALAR,
+		SL_SSE4,
+		SL_AVX2,
+		SL_AVX512,
+
+		SL_NUM
+	};
+
+	struct CpuFeatures
+	{
+		bool sse41 = false;
+		bool avx2 = false;
+		bool f16c = false;
+		bool avx512 = false;
+		bool bmi2 = false;
+		bool fastPdep = false;//bmi2 and pdep / pext not microcoded, amd before zen 3 takes hundreds of cycles
+	};
+
+	class Simd
+	{
+	public:
+		//detected once, os support for the wider registers included
+		static const CpuFeatures& getFeatures();
+		//runs cpuid every time, for initializers that can't rely on getFeatures being ready
+		static CpuFeatures detect();
+		static SimdLevel getLevel();
+		static const char* getName(SimdLevel level);
+	};
+}
+
+#endif
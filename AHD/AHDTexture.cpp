@@ -0,0 +1,123 @@
+#include "AHDTexture.h"
+#include "AHDSimd.h"
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+#ifdef AHD_X86
+#include <emmintrin.h>
+#endif
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	inline int wrap(int v, int size)
+	{
+		v %= size;
+		return v < 0 ? v + size : v;
+	}
+
+#ifdef AHD_X86
+	//the four taps widened to one float per channel, all channels blended at once
+	AHD_TARGET("sse2")
+	void blend(const unsigned int* taps, float ax, float ay, float* color)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128 t[4];
+		for (int i = 0; i < 4; ++i)
+			t[i] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)taps[i]), zero), zero));
+
+		__m128 x = _mm_set1_ps(ax);
+		__m128 top = _mm_add_ps(t[0], _mm_mul_ps(_mm_sub_ps(t[1], t[0]), x));
+		__m128 bottom = _mm_add_ps(t[2], _mm_mul_ps(_mm_sub_ps(t[3], t[2]), x));
+		__m128 c = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(ay)));
+		_mm_storeu_ps(color, _mm_div_ps(c, _mm_set1_ps(255.0f)));
+	}
+#else
+	void blend(const unsigned int* taps, float ax, float ay, float* color)
+	{
+		const unsigned char* t00 = (const unsigned char*)&taps[0];
+		const unsigned char* t10 = (const unsigned char*)&taps[1];
+		const unsigned char* t01 = (const unsigned char*)&taps[2];
+		const unsigned char* t11 = (const unsigned char*)&taps[3];
+		for (int c = 0; c < 4; ++c)
+		{
+			float top = t00[c] + (t10[c] - t00[c]) * ax;
+			float bottom = t01[c] + (t11[c] - t01[c]) * ax;
+			color[c] = (top + (bottom - top) * ay) / 255.0f;
+		}
+	}
+#endif
+}
+
+void MipTexture::build(size_t width, size_t height, const void* data)
+{
+	mLevels.assign(1, Level());
+	mLevels[0].width = width;
+	mLevels[0].height = height;
+	mLevels[0].texels.resize(width * height);
+	memcpy(mLevels[0].texels.data(), data, width * height * 4);
+
+	//odd sizes drop the last row or column, like d3d does
+	for (size_t n = 0; mLevels[n].width > 1 || mLevels[n].height > 1; ++n)
+	{
+		mLevels.resize(n + 2);
+		const Level& src = mLevels[n];
+		Level& dst = mLevels[n + 1];
+		dst.width = std::max(src.width / 2, (size_t)1);
+		dst.height = std::max(src.height / 2, (size_t)1);
+		dst.texels.resize(dst.width * dst.height);
+		for (size_t y = 0; y < dst.height; ++y)
+		{
+			size_t y0 = std::min(y * 2, src.height - 1) * src.width;
+			size_t y1 = std::min(y * 2 + 1, src.height - 1) * src.width;
+			for (size_t x = 0; x < dst.width; ++x)
+			{
+				size_t x0 = std::min(x * 2, src.width - 1);
+				size_t x1 = std::min(x * 2 + 1, src.width - 1);
+				const unsigned char* t00 = (const unsigned char*)&src.texels[x0 + y0];
+				const unsigned char* t10 = (const unsigned char*)&src.texels[x1 + y0];
+				const unsigned char* t01 = (const unsigned char*)&src.texels[x0 + y1];
+				const unsigned char* t11 = (const unsigned char*)&src.texels[x1 + y1];
+				unsigned int texel = 0;
+				for (int c = 0; c < 4; ++c)
+					texel |= (unsigned int)((t00[c] + t10[c] + t01[c] + t11[c] + 2) / 4) << (c * 8);
+				dst.texels[x + y * dst.width] = texel;
+			}
+		}
+	}
+}
+
+size_t MipTexture::selectLevel(float texelArea)const
+{
+	if (mLevels.size() < 2 || !(texelArea >= 4))
+		return 0;
+
+	//half of floor(log2(area)) is the level with one to two texels per side
+	int exponent;
+	frexp(texelArea, &exponent);
+	return std::min((size_t)((exponent - 1) / 2), mLevels.size() - 1);
+}
+
+void MipTexture::sample(size_t level, float u, float v, float* color)const
+{
+	const Level& l = mLevels[level];
+	int width = (int)l.width;
+	int height = (int)l.height;
+	float x = u * width - 0.5f;
+	float y = v * height - 0.5f;
+	float fx = floor(x);
+	float fy = floor(y);
+
+	int x0 = wrap((int)fx, width);
+	int y0 = wrap((int)fy, height);
+	int x1 = wrap(x0 + 1, width);
+	int y1 = wrap(y0 + 1, height);
+
+	unsigned int taps[4] = { l.texels[x0 + y0 * width], l.texels[x1 + y0 * width], l.texels[x0 + y1 * width], l.texels[x1 + y1 * width] };
+	blend(taps, x - fx, y - fy, color);
+}
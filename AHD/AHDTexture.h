@@ -0,0 +1,36 @@
+#ifndef _AHDTexture_H_
+#define _AHDTexture_H_
+
+#include <stddef.h>
+#include <vector>
+
+namespace AHD
+{
+	//bgra8 image with its box filtered mip chain down to 1x1, built once when the texture is
+	//added. coarse grids sample the level near one texel per voxel instead of the full image
+	class MipTexture
+	{
+	public:
+		struct Level
+		{
+			std::vector<unsigned int> texels;
+			size_t width;
+			size_t height;
+		};
+
+		void build(size_t width, size_t height, const void* data);
+		size_t getLevelCount()const{ return mLevels.size(); }
+		const Level& getLevel(size_t level)const{ return mLevels[level]; }
+
+		//level with one to two texels per sample on each side, for samples that cover
+		//texelArea texels of level 0
+		size_t selectLevel(float texelArea)const;
+		//bilinear, wrap. color in [0, 1], bgra
+		void sample(size_t level, float u, float v, float* color)const;
+
+	private:
+		std::vector<Level> mLevels;
+	};
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "AHDThreadPool.h"
+#include <atomic>
+#include <algorithm>
+
+using namespace AHD;
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+	for (size_t i = 1; i < threadCount; ++i)
+		mWorkers.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mStart.notify_all();
+
+	for (auto& i : mWorkers)
+		i.join();
+}
+
+void ThreadPool::run(const Task& task)
+{
+	if (mWorkers.empty())
+	{
+		task(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTask = &task;
+		mPending = mWorkers.size();
+		mError = nullptr;
+		++mGeneration;
+	}
+	mStart.notify_all();
+
+	std::exception_ptr error;
+	try
+	{
+		task(0);
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mFinish.wait(lock, [this](){ return mPending == 0; });
+	mTask = nullptr;
+	if (!error)
+		error = mError;
+	lock.unlock();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const RangeTask& task)
+{
+	if (count == 0)
+		return;
+
+	grain = std::max<size_t>(grain, 1);
+	std::atomic<size_t> cursor(0);
+	run([&](size_t thread)
+	{
+		while (true)
+		{
+			size_t begin = cursor.fetch_add(grain);
+			if (begin >= count)
+				break;
+			task(begin, std::min(begin + grain, count), thread);
+		}
+	});
+}
+
+void ThreadPool::parallelSteal(size_t count, const IndexTask& task)
+{
+	if (count == 0)
+		return;
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	size_t threads = getThreadCount();
+	std::vector<Queue> queues(threads);
+	for (size_t i = 0; i < count; ++i)
+		queues[i % threads].tasks.push_back(i);
+
+	auto take = [](Queue& queue, bool front, size_t& index)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			return false;
+
+		if (front)
+		{
+			index = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+		else
+		{
+			index = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+		return true;
+	};
+
+	run([&](size_t thread)
+	{
+		size_t index;
+		while (true)
+		{
+			//nothing is pushed while running, so once every deque is empty we are done
+			bool found = take(queues[thread], true, index);
+			for (size_t i = 1; i < threads && !found; ++i)
+				found = take(queues[(thread + i) % threads], false, index);
+			if (!found)
+				break;
+
+			task(index, thread);
+		}
+	});
+}
+
+void ThreadPool::work(size_t index)
+{
+	size_t generation = 0;
+	while (true)
+	{
+		const Task* task = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mStart.wait(lock, [this, generation](){ return mQuit || mGeneration != generation; });
+			if (mQuit)
+				return;
+			generation = mGeneration;
+			task = mTask;
+		}
+
+		std::exception_ptr error;
+		try
+		{
+			(*task)(index);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (error && !mError)
+			mError = error;
+		if (--mPending == 0)
+			mFinish.notify_one();
+	}
+}
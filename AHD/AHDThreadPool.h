@@ -0,0 +1,97 @@
+#ifndef _AHDThreadPool_H_
+#define _AHDThreadPool_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
+#include <algorithm>
+
+namespace AHD
+{
+	class ThreadPool
+	{
+	public:
+		typedef std::function<void(size_t)> Task;
+		typedef std::function<void(size_t, size_t, size_t)> RangeTask;
+		typedef std::function<void(size_t, size_t)> IndexTask;
+
+		//0 means one thread per hardware thread
+		ThreadPool(size_t threadCount = 0);
+		~ThreadPool();
+
+		size_t getThreadCount()const{ return mWorkers.size() + 1; }
+
+		//call task(threadIndex) once on every thread and wait for all of them,
+		//the calling thread works as index 0. not reentrant.
+		void run(const Task& task);
+
+		//split [0, count) into chunks of grain, task(begin, end, threadIndex)
+		void parallelFor(size_t count, size_t grain, const RangeTask& task);
+
+		//task(index, threadIndex) for every index in [0, count). indexes are dealt round robin
+		//into one deque per thread, a thread takes from the front of its own deque and steals
+		//from the back of the others once it is empty, so put the expensive ones first.
+		void parallelSteal(size_t count, const IndexTask& task);
+
+		//one chunk per thread sorted alone, then merged pairwise with every pair of a round in parallel
+		template<class T, class Less>
+		void parallelSort(T* first, T* last, Less less);
+
+	private:
+		void work(size_t index);
+
+	private:
+		std::vector<std::thread> mWorkers;
+		std::mutex mMutex;
+		std::condition_variable mStart;
+		std::condition_variable mFinish;
+
+		const Task* mTask = nullptr;
+		size_t mGeneration = 0;
+		size_t mPending = 0;
+		bool mQuit = false;
+		std::exception_ptr mError;
+	};
+
+	template<class T, class Less>
+	void ThreadPool::parallelSort(T* first, T* last, Less less)
+	{
+		const size_t MIN_CHUNK = 4096;
+		size_t count = last - first;
+		size_t chunks = std::min(getThreadCount(), std::max<size_t>(count / MIN_CHUNK, 1));
+		if (chunks == 1)
+		{
+			std::sort(first, last, less);
+			return;
+		}
+
+		std::vector<size_t> bounds(chunks + 1);
+		for (size_t i = 0; i <= chunks; ++i)
+			bounds[i] = count * i / chunks;
+		parallelFor(chunks, 1, [&](size_t begin, size_t end, size_t thread)
+		{
+			for (size_t i = begin; i < end; ++i)
+				std::sort(first + bounds[i], first + bounds[i + 1], less);
+		});
+
+		for (size_t width = 1; width < chunks; width *= 2)
+		{
+			parallelFor((chunks + width * 2 - 1) / (width * 2), 1, [&](size_t begin, size_t end, size_t thread)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					size_t low = i * width * 2;
+					size_t middle = std::min(low + width, chunks);
+					size_t high = std::min(low + width * 2, chunks);
+					std::inplace_merge(first + bounds[low], first + bounds[middle], first + bounds[high], less);
+				}
+			});
+		}
+	}
+}
+
+#endif
@@ -1,5 +1,12 @@
 #include "AHDUtils.h"
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
 using namespace AHD;
 
 const Vector3 Vector3::ZERO(0, 0, 0);
@@ -10,4 +17,54 @@ const Vector3 Vector3::UNIT_Z(0, 0, 1);
 const Vector3 Vector3::NEGATIVE_UNIT_X(-1, 0, 0);
 const Vector3 Vector3::NEGATIVE_UNIT_Y(0, -1, 0);
 const Vector3 Vector3::NEGATIVE_UNIT_Z(0, 0, -1);
-const Vector3 Vector3::UNIT_SCALE(1, 1, 1);
\ No newline at end of file
+const Vector3 Vector3::UNIT_SCALE(1, 1, 1);
+
+const Matrix4 Matrix4::IDENTITY(
+	1, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 0, 1, 0,
+	0, 0, 0, 1);
+
+
+namespace
+{
+	long long getTicks()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER ticks;
+		QueryPerformanceCounter(&ticks);
+		return ticks.QuadPart;
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	double getTicksPerMillisecond()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart / 1000.0;
+#else
+		return 1000000.0;
+#endif
+	}
+
+	const double gTicksPerMillisecond = getTicksPerMillisecond();
+}
+
+Timer::Timer()
+{
+	reset();
+}
+
+void Timer::reset()
+{
+	mStart = getTicks();
+}
+
+double Timer::getMilliseconds()const
+{
+	return (getTicks() - mStart) / gTicksPerMillisecond;
+}
@@ -2,6 +2,7 @@
 #define _AHDUtils_H_
 
 #include <assert.h>
+#include <stddef.h>
 
 namespace AHD
 {
@@ -19,6 +20,26 @@ namespace AHD
 		{
 		}
 
+		inline float operator [] (const size_t i) const
+		{
+			assert(i < 3);
+			return *(&x + i);
+		}
+
+		inline float& operator [] (const size_t i)
+		{
+			assert(i < 3);
+			return *(&x + i);
+		}
+
+		inline Vector3 operator + (const Vector3& rkVector) const
+		{
+			return Vector3(
+				x + rkVector.x,
+				y + rkVector.y,
+				z + rkVector.z);
+		}
+
 		inline Vector3 operator - () const
 		{
 			return Vector3(-x, -y, -z);
@@ -40,6 +61,14 @@ namespace AHD
 				z * fScalar);
 		}
 
+		inline Vector3 operator * (const Vector3& rhs) const
+		{
+			return Vector3(
+				x * rhs.x,
+				y * rhs.y,
+				z * rhs.z);
+		}
+
 		inline Vector3 operator / (const float fScalar) const
 		{
 			assert(fScalar != 0.0);
@@ -62,6 +91,19 @@ namespace AHD
 			return *this;
 		}
 
+		inline float dotProduct(const Vector3& vec) const
+		{
+			return x * vec.x + y * vec.y + z * vec.z;
+		}
+
+		inline Vector3 crossProduct(const Vector3& rkVector) const
+		{
+			return Vector3(
+				y * rkVector.z - z * rkVector.y,
+				z * rkVector.x - x * rkVector.z,
+				x * rkVector.y - y * rkVector.x);
+		}
+
 		inline void makeFloor(const Vector3& cmp)
 		{
 			if (cmp.x < x) x = cmp.x;
@@ -98,6 +140,53 @@ namespace AHD
 	
 	};
 
+	//row vectors like XMMATRIX, a point is transformed as p * m and the translation is m[3]
+	class Matrix4
+	{
+	public:
+		float m[4][4];
+
+		inline Matrix4()
+		{
+		}
+
+		inline Matrix4(
+			float m00, float m01, float m02, float m03,
+			float m10, float m11, float m12, float m13,
+			float m20, float m21, float m22, float m23,
+			float m30, float m31, float m32, float m33)
+		{
+			m[0][0] = m00; m[0][1] = m01; m[0][2] = m02; m[0][3] = m03;
+			m[1][0] = m10; m[1][1] = m11; m[1][2] = m12; m[1][3] = m13;
+			m[2][0] = m20; m[2][1] = m21; m[2][2] = m22; m[2][3] = m23;
+			m[3][0] = m30; m[3][1] = m31; m[3][2] = m32; m[3][3] = m33;
+		}
+
+		inline Vector3 transformAffine(const Vector3& v) const
+		{
+			return Vector3(
+				v.x * m[0][0] + v.y * m[1][0] + v.z * m[2][0] + m[3][0],
+				v.x * m[0][1] + v.y * m[1][1] + v.z * m[2][1] + m[3][1],
+				v.x * m[0][2] + v.y * m[1][2] + v.z * m[2][2] + m[3][2]);
+		}
+
+		inline Vector3 getTrans() const
+		{
+			return Vector3(m[3][0], m[3][1], m[3][2]);
+		}
+
+		inline static Matrix4 makeTrans(const Vector3& v)
+		{
+			return Matrix4(
+				1, 0, 0, 0,
+				0, 1, 0, 0,
+				0, 0, 1, 0,
+				v.x, v.y, v.z, 1);
+		}
+
+		static const Matrix4 IDENTITY;
+	};
+
 	class AABB
 	{
 	public:
@@ -194,11 +283,34 @@ namespace AHD
 			mType = T_INVALID;
 		}
 
+		//bound of the 8 transformed corners
+		inline void transformAffine(const Matrix4& m)
+		{
+			if (!isValid()) return;
+			Vector3 min = mMin;
+			Vector3 max = mMax;
+			setNull();
+			for (int i = 0; i < 8; ++i)
+				merge(m.transformAffine(Vector3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z)));
+		}
+
 	private:
 		Vector3 mMin;
 		Vector3 mMax;
 		Type mType = T_INVALID;
 	};
+
+	class Timer
+	{
+	public:
+		Timer();
+
+		void reset();
+		double getMilliseconds()const;
+
+	private:
+		long long mStart;
+	};
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include "AHDVertex.h"
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <stdexcept>
+
+#ifdef AHD_X86
+#include <immintrin.h>
+#endif
+
+#undef max
+#undef min
+
+using namespace AHD;
+
+namespace
+{
+	AABB makeBound(const float* low, const float* high)
+	{
+		AABB aabb;
+		aabb.setExtents(Vector3(low[0], low[1], low[2]), Vector3(high[0], high[1], high[2]));
+		return aabb;
+	}
+
+	//own detection, the features of AHDSimd.cpp may not be initialized yet
+	const bool gF16c = Simd::detect().f16c;
+
+	size_t getComponentSize(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VF_HALF:
+		case VF_SNORM16:
+		case VF_UNORM16: return 2;
+		case VF_UNORM8: return 1;
+		default: return 4;
+		}
+	}
+
+	float halfToFloat(unsigned short h)
+	{
+		unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+		unsigned int exponent = (h >> 10) & 0x1f;
+		unsigned int mantissa = h & 0x3ff;
+		unsigned int bits;
+		if (exponent == 0x1f)
+			bits = sign | 0x7f800000 | (mantissa << 13);
+		else if (exponent != 0)
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else
+		{
+			//zero or subnormal, exact in float
+			float f = mantissa * (1.0f / (1 << 24));
+			memcpy(&bits, &f, 4);
+			bits |= sign;
+		}
+		float f;
+		memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	void decodeScalar(VertexFormat format, const char* data, int components, float* out)
+	{
+		for (int i = 0; i < components; ++i)
+		{
+			switch (format)
+			{
+			case VF_HALF: out[i] = halfToFloat(((const unsigned short*)data)[i]); break;
+			case VF_SNORM16: out[i] = std::max(((const short*)data)[i] / 32767.0f, -1.0f); break;
+			case VF_UNORM16: out[i] = ((const unsigned short*)data)[i] / 65535.0f; break;
+			case VF_UNORM8: out[i] = ((const unsigned char*)data)[i] / 255.0f; break;
+			default: memcpy(out + i, data + i * 4, 4); break;
+			}
+		}
+	}
+
+#ifdef AHD_X86
+	//up to 4 components widened to 32 bit lanes, the copy keeps the loads inside the vertex
+	AHD_TARGET("sse2")
+	void decodeSse2(VertexFormat format, const char* data, int components, float* out)
+	{
+		char in[16] = {};
+		memcpy(in, data, components * getComponentSize(format));
+		__m128i x = _mm_loadu_si128((const __m128i*)in);
+		__m128i zero = _mm_setzero_si128();
+		__m128 v;
+		switch (format)
+		{
+		case VF_SNORM16:
+			v = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+			v = _mm_max_ps(_mm_div_ps(v, _mm_set1_ps(32767.0f)), _mm_set1_ps(-1.0f));
+			break;
+		case VF_UNORM16:
+			v = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero)), _mm_set1_ps(65535.0f));
+			break;
+		case VF_UNORM8:
+			v = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero)), _mm_set1_ps(255.0f));
+			break;
+		default:
+			v = _mm_castsi128_ps(x);
+			break;
+		}
+		float f[4];
+		_mm_storeu_ps(f, v);
+		memcpy(out, f, components * 4);
+	}
+
+	AHD_TARGET("avx,f16c")
+	void decodeF16c(const char* data, int components, float* out)
+	{
+		unsigned short in[4] = {};
+		memcpy(in, data, components * 2);
+		float f[4];
+		_mm_storeu_ps(f, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)in)));
+		memcpy(out, f, components * 4);
+	}
+#endif
+}
+
+AABB VertexBound::scalar(const char* vertices, size_t count, size_t stride)
+{
+	AABB aabb;
+	for (size_t i = 0; i < count; ++i, vertices += stride)
+		aabb.merge(*(const Vector3*)vertices);
+	return aabb;
+}
+
+#ifdef AHD_X86
+AHD_TARGET("sse2")
+AABB VertexBound::sse2(const char* vertices, size_t count, size_t stride)
+{
+	if (count == 0)
+		return AABB();
+
+	//x, y, z, z so no load reads past the last position
+	const float* p = (const float*)vertices;
+	__m128 low = _mm_setr_ps(p[0], p[1], p[2], p[2]);
+	__m128 high = low;
+	for (size_t i = 1; i < count; ++i)
+	{
+		p = (const float*)(vertices + i * stride);
+		__m128 v = _mm_setr_ps(p[0], p[1], p[2], p[2]);
+		low = _mm_min_ps(low, v);
+		high = _mm_max_ps(high, v);
+	}
+
+	float l[4], h[4];
+	_mm_storeu_ps(l, low);
+	_mm_storeu_ps(h, high);
+	return makeBound(l, h);
+}
+
+AHD_TARGET("avx2")
+AABB VertexBound::avx2(const char* vertices, size_t count, size_t stride)
+{
+	//byte offsets of 8 vertices from the first, in 32 bits
+	if (count < 8 || stride > INT_MAX / 8)
+		return sse2(vertices, count, stride);
+
+	__m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+	__m256 low[3], high[3];
+	for (int i = 0; i < 3; ++i)
+		low[i] = high[i] = _mm256_i32gather_ps((const float*)vertices + i, lanes, 1);
+
+	size_t n = 8;
+	for (; n + 8 <= count; n += 8)
+	{
+		const float* base = (const float*)(vertices + n * stride);
+		for (int i = 0; i < 3; ++i)
+		{
+			__m256 v = _mm256_i32gather_ps(base + i, lanes, 1);
+			low[i] = _mm256_min_ps(low[i], v);
+			high[i] = _mm256_max_ps(high[i], v);
+		}
+	}
+
+	float l[3], h[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		float lv[8], hv[8];
+		_mm256_storeu_ps(lv, low[i]);
+		_mm256_storeu_ps(hv, high[i]);
+		l[i] = *std::min_element(lv, lv + 8);
+		h[i] = *std::max_element(hv, hv + 8);
+	}
+	AABB aabb = makeBound(l, h);
+	if (n < count)
+		aabb.merge(sse2(vertices + n * stride, count - n, stride));
+	return aabb;
+}
+#else
+AABB VertexBound::sse2(const char* vertices, size_t count, size_t stride)
+{
+	return scalar(vertices, count, stride);
+}
+
+AABB VertexBound::avx2(const char* vertices, size_t count, size_t stride)
+{
+	return scalar(vertices, count, stride);
+}
+#endif
+
+AABB VertexBound::compute(const void* vertices, size_t count, size_t stride, SimdLevel level)
+{
+	const char* data = (const char*)vertices;
+#ifdef AHD_X86
+	if (level >= SL_AVX2)
+		return avx2(data, count, stride);
+	return sse2(data, count, stride);
+#else
+	return scalar(data, count, stride);
+#endif
+}
+
+AABB VertexBound::compute(const VertexDesc& pos, const void* vertices, size_t count, size_t stride)
+{
+	const char* data = (const char*)vertices + pos.offset;
+	if (pos.format == VF_FLOAT || pos.format == VF_DEFAULT)
+	{
+		//scale and bias are affine per axis, so they go on the raw bound, a negative scale
+		//swaps its ends
+		AABB raw = compute(data, count, stride);
+		if (!raw.isValid())
+			return raw;
+		float low[3], high[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			float a = raw.getMin()[i] * pos.scale[i] + pos.bias[i];
+			float b = raw.getMax()[i] * pos.scale[i] + pos.bias[i];
+			low[i] = std::min(a, b);
+			high[i] = std::max(a, b);
+		}
+		return makeBound(low, high);
+	}
+
+	const size_t BLOCK = 256;
+	Vector3 block[BLOCK];
+	AABB aabb;
+	for (size_t begin = 0; begin < count; begin += BLOCK)
+	{
+		size_t size = std::min(BLOCK, count - begin);
+		for (size_t i = 0; i < size; ++i)
+			VertexDecoder::decode(pos, data - pos.offset + (begin + i) * stride, &block[i].x);
+		aabb.merge(compute(block, size, sizeof(Vector3)));
+	}
+	return aabb;
+}
+
+int VertexDecoder::getComponents(Semantic semantic)
+{
+	switch (semantic)
+	{
+	case S_POSITION: return 3;
+	case S_COLOR: return 4;
+	default: return 2;
+	}
+}
+
+size_t VertexDecoder::getSize(Semantic semantic, VertexFormat format)
+{
+	if (format == VF_DEFAULT)
+		format = semantic == S_COLOR ? VF_UNORM8 : VF_FLOAT;
+	return getComponents(semantic) * getComponentSize(format);
+}
+
+VertexDesc VertexDecoder::resolve(const VertexDesc& desc)
+{
+	VertexDesc resolved = desc;
+	if (desc.format < 0 || desc.format >= VF_NUM)
+		throw std::runtime_error("unknown vertex format");
+	if (desc.format == VF_DEFAULT)
+		resolved.format = desc.semantic == S_COLOR ? VF_UNORM8 : VF_FLOAT;
+	if (desc.size < getSize(desc.semantic, resolved.format))
+		throw std::runtime_error("vertex attribute smaller than its format");
+
+	for (int i = 0; i < 3; ++i)
+	{
+		if (desc.semantic != S_POSITION)
+		{
+			resolved.scale[i] = 1;
+			resolved.bias[i] = 0;
+		}
+		else if (desc.scale[i] == 0)
+			resolved.scale[i] = 1;
+	}
+	return resolved;
+}
+
+void VertexDecoder::decode(const VertexDesc& desc, const char* vertex, float* out)
+{
+	const char* data = vertex + desc.offset;
+	int components = getComponents(desc.semantic);
+	if (desc.format == VF_FLOAT)
+		memcpy(out, data, components * 4);
+	else
+	{
+#ifdef AHD_X86
+		if (desc.format != VF_HALF)
+			decodeSse2(desc.format, data, components, out);
+		else if (gF16c)
+			decodeF16c(data, components, out);
+		else
+#endif
+			decodeScalar(desc.format, data, components, out);
+	}
+
+	if (desc.semantic == S_POSITION)
+	{
+		for (int i = 0; i < 3; ++i)
+			out[i] = out[i] * desc.scale[i] + desc.bias[i];
+	}
+}
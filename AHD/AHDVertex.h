@@ -0,0 +1,39 @@
+#ifndef _AHDVertex_H_
+#define _AHDVertex_H_
+
+#include "AHD.h"
+#include "AHDUtils.h"
+#include "AHDSimd.h"
+
+namespace AHD
+{
+	//bound of the float3 positions in a strided vertex buffer. avx2 gathers 8 vertices into
+	//x, y and z lanes and reduces them at once, the narrower ones take a vertex at a time
+	class VertexBound
+	{
+	public:
+		static AABB scalar(const char* vertices, size_t count, size_t stride);
+		static AABB sse2(const char* vertices, size_t count, size_t stride);
+		static AABB avx2(const char* vertices, size_t count, size_t stride);
+		//vertices points at the position of the first vertex
+		static AABB compute(const void* vertices, size_t count, size_t stride, SimdLevel level = Simd::getLevel());
+		//positions of any format with the scale and bias of pos (resolved), formats other than
+		//float are decoded a block at a time first
+		static AABB compute(const VertexDesc& pos, const void* vertices, size_t count, size_t stride);
+	};
+
+	//one attribute of a vertex to floats, with sse2 and f16c where the cpu has them
+	class VertexDecoder
+	{
+	public:
+		static int getComponents(Semantic semantic);
+		static size_t getSize(Semantic semantic, VertexFormat format);
+		//VF_DEFAULT to the format it stands for, zero position scales to 1. throws when
+		//desc.size can't hold the components
+		static VertexDesc resolve(const VertexDesc& desc);
+		//desc resolved, out gets getComponents(desc.semantic) floats
+		static void decode(const VertexDesc& desc, const char* vertex, float* out);
+	};
+}
+
+#endif
@@ -82,7 +82,11 @@ GS_INPUT vs(VS_INPUT input)
 [maxvertexcount(3)]
 void gs(triangle GS_INPUT input[3], inout TriangleStream<PS_INPUT> output)
 {
-	float3 normal = normalize(cross((input[1].pos - input[0].pos).xyz, (input[2].pos - input[1].pos).xyz));
+	//dominant axis in voxel units, world may scale the axes differently
+	float4 pos[3];
+	for (int n = 0; n < 3; ++n)
+		pos[n] = mul(input[n].pos, World);
+	float3 normal = normalize(cross((pos[1] - pos[0]).xyz, (pos[2] - pos[1]).xyz));
 		float X = abs(normal.x);
 	float Y = abs(normal.y);
 	float Z = abs(normal.z);
@@ -108,8 +112,7 @@ void gs(triangle GS_INPUT input[3], inout TriangleStream<PS_INPUT> output)
 	for (int i = 0; i < 3; ++i)
 	{
 		PS_INPUT o;
-		o.pos = mul(input[i].pos, World);
-		o.pos = mul(o.pos, view);
+		o.pos = mul(pos[i], view);
 		o.pos = mul(o.pos, Projection);
 		o.axis = axis;
 #ifdef USINGCOLOR
@@ -0,0 +1,126 @@
+//triangle/voxel overlap kernels against the scalar path
+//  g++ -O2 -std=c++11 -I../AHD -I../3Party OverlapBench.cpp ../AHD/AHDOverlap.cpp ../AHD/AHDSimd.cpp ../AHD/AHDUtils.cpp ../3Party/tiny_obj_loader.cc
+//  OverlapBench [scale] [model.obj ...], default is 100 and ../cup.obj
+
+#include "AHDOverlap.h"
+#include "tiny_obj_loader.h"
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+
+using namespace AHD;
+
+struct Batch
+{
+	TriangleBoxTest test;
+	size_t first;
+	size_t count;
+};
+
+struct Candidates
+{
+	std::vector<int> x, y, z;
+	std::vector<Batch> batches;
+};
+
+void collect(Candidates& candidates, const std::vector<tinyobj::shape_t>& shapes, float scale)
+{
+	AABB bound;
+	for (auto& s : shapes)
+		for (size_t i = 0; i + 2 < s.mesh.positions.size(); i += 3)
+			bound.merge(Vector3(s.mesh.positions[i], s.mesh.positions[i + 1], s.mesh.positions[i + 2]));
+
+	for (auto& s : shapes)
+	{
+		auto& pos = s.mesh.positions;
+		auto& idx = s.mesh.indices;
+		for (size_t t = 0; t + 2 < idx.size(); t += 3)
+		{
+			Vector3 tri[3];
+			AABB box;
+			for (int k = 0; k < 3; ++k)
+			{
+				const float* p = &pos[idx[t + k] * 3];
+				tri[k] = (Vector3(p[0], p[1], p[2]) - bound.getMin()) * scale;
+				box.merge(tri[k]);
+			}
+
+			Batch batch;
+			batch.test.setup(tri, Vector3::UNIT_SCALE);
+			batch.first = candidates.x.size();
+			for (int z = (int)floor(box.getMin().z); z <= (int)floor(box.getMax().z); ++z)
+				for (int y = (int)floor(box.getMin().y); y <= (int)floor(box.getMax().y); ++y)
+					for (int x = (int)floor(box.getMin().x); x <= (int)floor(box.getMax().x); ++x)
+					{
+						candidates.x.push_back(x);
+						candidates.y.push_back(y);
+						candidates.z.push_back(z);
+					}
+			batch.count = candidates.x.size() - batch.first;
+			candidates.batches.push_back(batch);
+		}
+	}
+}
+
+double run(OverlapKernel kernel, const Candidates& candidates, std::vector<unsigned char>& result, size_t& hits)
+{
+	const int REPEAT = 5;
+	double best = 1e30;
+	for (int r = 0; r < REPEAT; ++r)
+	{
+		hits = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (auto& b : candidates.batches)
+			hits += kernel(b.test, &candidates.x[b.first], &candidates.y[b.first], &candidates.z[b.first], b.count, &result[b.first]);
+		auto end = std::chrono::high_resolution_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	float scale = argc > 1 ? (float)atof(argv[1]) : 100.0f;
+	std::vector<const char*> models;
+	for (int i = 2; i < argc; ++i)
+		models.push_back(argv[i]);
+	if (models.empty())
+		models.push_back("../cup.obj");
+
+	std::cout << "cpu: " << Simd::getName(Simd::getLevel()) << std::endl;
+
+	for (auto model : models)
+	{
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string err = tinyobj::LoadObj(shapes, materials, model);
+		if (!err.empty() && shapes.empty())
+		{
+			std::cout << model << ": " << err << std::endl;
+			continue;
+		}
+
+		Candidates candidates;
+		collect(candidates, shapes, scale);
+		size_t count = candidates.x.size();
+		std::cout << model << ": " << candidates.batches.size() << " triangles, " << count << " candidate voxels" << std::endl;
+
+		std::vector<unsigned char> reference(count), result(count);
+		size_t referenceHits = 0;
+		double scalarTime = run(&Overlap::scalar, candidates, reference, referenceHits);
+
+		for (int level = SL_SCALAR; level <= Simd::getLevel(); ++level)
+		{
+			size_t hits = 0;
+			double time = run(Overlap::getKernel((SimdLevel)level), candidates, result, hits);
+			bool same = hits == referenceHits && std::equal(result.begin(), result.end(), reference.begin());
+			std::cout << "  " << Simd::getName((SimdLevel)level)
+				<< ": " << time << " ms, " << count / time / 1000.0 << " Mvoxel/s, x" << scalarTime / time
+				<< ", hits " << hits << (same ? "" : " MISMATCH") << std::endl;
+		}
+	}
+	return 0;
+}
@@ -14,7 +14,7 @@
 #include "AHDUtils.h"
 #include "ring.h"
 #include "TextureLoader.h"
-#include <hash_map>
+#include <unordered_map>
 
 #pragma comment (lib,"d3d11.lib")
 #pragma comment (lib,"d3dx11.lib")
@@ -46,27 +46,6 @@ ID3D11Buffer*		optimizedVertices = NULL;
 ID3D11Buffer*		optimizedIndexes = NULL;
 size_t drawCount = 0;
 
-typedef __int64 KEY;
-
-KEY getKey(int x, int y, int z)
-{
-	//int key = (x << 21) + ((y << 11) & (1023 << 11)) + (z & 2047);
-	//return key;
-
-	union
-	{
-		struct
-		{
-			short x;
-			short y;
-			short z;
-		};
-
-		__int64 key;
-	}hash = {x,y,z};
-	return hash.key;
-};
-
 class VoxelData : public VoxelOutput
 {
 public:
@@ -84,13 +63,9 @@ public:
 
 		for (int i = 0; i < size; ++i)
 		{
-			int x = voxels[i].pos[0];
-			int y = voxels[i].pos[1];
-			int z = voxels[i].pos[2];
-
 			auto& color = voxels[i].color;
 			//data[x + y * len + z * len * len] = color[0]  + (color[1] << 8) + (color[2] << 16) + 0xff000000;
-			datas[getKey(x,y,z)] = color[0] + (color[1] << 8) + (color[2] << 16) + 0xff000000;
+			datas[voxels[i].getKey()] = color[0] + (color[1] << 8) + (color[2] << 16) + 0xff000000;
 
 		}
 
@@ -98,7 +73,12 @@ public:
 
 		std::cout << "width: " << width << " height: " << height << " depth: " << depth << std::endl;
 	}
-	std::hash_map<KEY, int> datas;
+	void clear()
+	{
+		datas.clear();
+		count = width = height = depth = 0;
+	}
+	std::unordered_map<VoxelKey, int> datas;
 	int count;
 	int width = 0;
 	int height = 0;
@@ -107,6 +87,9 @@ public:
 VoxelData		voxels;
 std::vector<shape_t> shapes;
 std::vector<material_t> materials;
+//made once at load, the keys only change the size
+Voxelizer* voxelizer = nullptr;
+std::vector<VoxelResource*> subs;
 
 struct Material
 {
@@ -179,6 +162,7 @@ enum Key
 };
 
 
+void createResources();
 void voxelize(float s = 1.0);
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -570,6 +554,7 @@ HRESULT initGeometry()
 
 	std::cout << (GetTickCount() - timer) << " ms" << std::endl;
 
+	createResources();
 	voxelize(scale);
 
 	camera.pos = XMVectorSet(0.0f, 0.0f, -voxels.width * 2, 0.0f);
@@ -626,7 +611,7 @@ void optimizeVoxels()
 			return 0;
 
 		static int blank = 0;
-		auto ret = data.find(getKey(x,y,z));
+		auto ret = data.find(VoxelKey::make(x, y, z));
 		if (ret == data.end())
 			//return data + x + y * width + z * height * width;
 			return &blank;
@@ -825,18 +810,11 @@ void optimizeVoxels()
 
 }
 
-void voxelize(float s)
+void createResources()
 {
-	Voxelizer v;
-
-	v.setSize(1.0f,s);
-
-	std::cout << "Voxelizing...";
-	long timer = GetTickCount();
-
+	voxelizer = new Voxelizer();
+	Voxelizer& v = *voxelizer;
 
-	std::vector<VoxelResource*> subs;
-	AABB aabb;
 	std::vector<char> buffer;
 	for (int i = 0; i < shapes.size();++i)
 	{
@@ -900,10 +878,17 @@ void voxelize(float s)
 	}
 
 	buffer.swap(std::vector<char>());
+}
 
+void voxelize(float s)
+{
+	voxelizer->setSize(1.0f, s);
 
+	std::cout << "Voxelizing...";
+	long timer = GetTickCount();
 
-	v.voxelize(&voxels, subs.size(), subs.data());
+	voxels.clear();
+	voxelizer->voxelize(&voxels, subs.size(), subs.data());
 
 
 
@@ -938,6 +923,7 @@ void cleanDevice()
 	SAFE_RELEASE(context);
 	SAFE_RELEASE(device);
 
+	delete voxelizer;
 }
 
 void render()
@@ -0,0 +1,84 @@
+//an incremental voxelize after the texture of a cached resource is replaced under the same
+//name, the voxels have to take the new color instead of the cached one
+//  g++ -O2 -std=c++11 -pthread -I../AHD -I../3Party IncrementalTextureTest.cpp $(ls ../AHD/*.cpp | grep -v d3d11) ../3Party/tiny_obj_loader.cc
+//  IncrementalTextureTest, returns 1 on stale colors
+
+#include "AHD.h"
+#include <vector>
+#include <iostream>
+
+using namespace AHD;
+
+namespace
+{
+	struct Output : VoxelOutput
+	{
+		std::vector<Voxel> voxels;
+		void output(Voxel* data, size_t size){ voxels.insert(voxels.end(), data, data + size); }
+	};
+
+	struct Vertex
+	{
+		float pos[3];
+		float uv[2];
+	};
+
+	//every voxel of the last voxelize has bgra
+	bool isColor(Voxelizer& voxelizer, VoxelResource* res, unsigned int bgra)
+	{
+		Output output;
+		voxelizer.voxelize(&output, 1, &res);
+		if (output.voxels.empty())
+			return false;
+		for (auto& i : output.voxels)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				if (i.color[c] != (int)((bgra >> (c * 8)) & 0xff))
+					return false;
+			}
+		}
+		return true;
+	}
+}
+
+int main()
+{
+	const Vertex quad[6] =
+	{
+		{ { 0, 0, 0 }, { 0, 0 } }, { { 1, 0, 0 }, { 1, 0 } }, { { 1, 1, 0.5f }, { 1, 1 } },
+		{ { 0, 0, 0 }, { 0, 0 } }, { { 1, 1, 0.5f }, { 1, 1 } }, { { 0, 1, 0.5f }, { 0, 1 } },
+	};
+	VertexDesc desc[] = { { S_POSITION, 0, 12 }, { S_TEXCOORD, 12, 8 } };
+
+	const unsigned int RED = 0xffff0000, BLUE = 0xff0000ff;
+	std::vector<unsigned int> texels(16 * 16, RED);
+
+	Voxelizer voxelizer(Voxelizer::B_CPU);
+	voxelizer.setSize(1, 32);
+	voxelizer.setIncremental(true);
+	voxelizer.addTexture("albedo", 16, 16, texels.data());
+	VoxelResource* res = voxelizer.createResource();
+	res->setVertex(quad, 6, sizeof(Vertex), desc, 2);
+	res->setTexture("albedo");
+
+	bool ok = true;
+	if (!isColor(voxelizer, res, RED))
+	{
+		std::cout << "first voxelize is not red\n";
+		ok = false;
+	}
+
+	texels.assign(texels.size(), BLUE);
+	voxelizer.addTexture("albedo", 16, 16, texels.data());
+	if (!isColor(voxelizer, res, BLUE))
+	{
+		std::cout << "voxelize after replacing the texture is not blue\n";
+		ok = false;
+	}
+
+	if (!ok)
+		return 1;
+	std::cout << "ok\n";
+	return 0;
+}
@@ -0,0 +1,101 @@
+//float positions with a scale and bias against the same positions transformed up front,
+//the grid fitted from the bound and the voxels have to be the same
+//  g++ -O2 -std=c++11 -pthread -I../AHD -I../3Party VertexScaleTest.cpp $(ls ../AHD/*.cpp | grep -v d3d11) ../3Party/tiny_obj_loader.cc
+//  VertexScaleTest, returns 1 on a mismatch
+
+#include "AHD.h"
+#include <vector>
+#include <iostream>
+#include <math.h>
+
+using namespace AHD;
+
+namespace
+{
+	struct Output : VoxelOutput
+	{
+		std::vector<Voxel> voxels;
+		void output(Voxel* data, size_t size){ voxels.insert(voxels.end(), data, data + size); }
+	};
+
+	void makeSphere(std::vector<float>& positions, std::vector<unsigned int>& indexes)
+	{
+		const int RINGS = 24;
+		const float PI = 3.14159265f;
+		for (int i = 0; i <= RINGS; ++i)
+		{
+			for (int j = 0; j < RINGS * 2; ++j)
+			{
+				float theta = PI * i / RINGS, phi = PI * j / RINGS;
+				positions.push_back(sinf(theta) * cosf(phi));
+				positions.push_back(cosf(theta));
+				positions.push_back(sinf(theta) * sinf(phi));
+			}
+		}
+		for (int i = 0; i < RINGS; ++i)
+		{
+			for (int j = 0; j < RINGS * 2; ++j)
+			{
+				unsigned int a = i * RINGS * 2 + j, b = i * RINGS * 2 + (j + 1) % (RINGS * 2);
+				unsigned int quad[6] = { a, b, a + RINGS * 2, b, b + RINGS * 2, a + RINGS * 2 };
+				indexes.insert(indexes.end(), quad, quad + 6);
+			}
+		}
+	}
+
+	void run(const std::vector<float>& positions, const std::vector<unsigned int>& indexes, const VertexDesc& desc, Output& output, int* size)
+	{
+		Voxelizer voxelizer(Voxelizer::B_CPU);
+		voxelizer.setSize(1, 8);
+		VoxelResource* res = voxelizer.createResource();
+		res->setVertex(positions.data(), positions.size() / 3, 12, &desc, 1);
+		res->setIndex(indexes.data(), indexes.size(), 4);
+		voxelizer.voxelize(&output, 1, &res);
+		voxelizer.getGridSize(size);
+	}
+}
+
+int main()
+{
+	std::vector<float> positions;
+	std::vector<unsigned int> indexes;
+	makeSphere(positions, indexes);
+
+	const float scale[3] = { 10, 6, -4 };
+	const float bias[3] = { 3, -20, 7 };
+	std::vector<float> transformed(positions);
+	for (size_t i = 0; i < transformed.size(); ++i)
+		transformed[i] = transformed[i] * scale[i % 3] + bias[i % 3];
+
+	VertexDesc plain = { S_POSITION, 0, 12, VF_FLOAT };
+	VertexDesc scaled = plain;
+	for (int i = 0; i < 3; ++i)
+	{
+		scaled.scale[i] = scale[i];
+		scaled.bias[i] = bias[i];
+	}
+
+	Output expected, result;
+	int expectedSize[3], resultSize[3];
+	run(transformed, indexes, plain, expected, expectedSize);
+	run(positions, indexes, scaled, result, resultSize);
+
+	bool same = expected.voxels.size() == result.voxels.size();
+	for (int i = 0; i < 3; ++i)
+		same = same && expectedSize[i] == resultSize[i];
+	for (size_t i = 0; same && i < expected.voxels.size(); ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			same = same && expected.voxels[i].pos[c] == result.voxels[i].pos[c];
+	}
+
+	std::cout << "grid " << resultSize[0] << " " << resultSize[1] << " " << resultSize[2] << " voxels " << result.voxels.size()
+		<< ", expected grid " << expectedSize[0] << " " << expectedSize[1] << " " << expectedSize[2] << " voxels " << expected.voxels.size() << "\n";
+	if (!same)
+	{
+		std::cout << "scaled float positions differ from transformed ones\n";
+		return 1;
+	}
+	std::cout << "ok\n";
+	return 0;
+}